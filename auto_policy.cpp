@@ -0,0 +1,144 @@
+#include "stdafx.h"
+
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#include "auto_policy.h"
+#include "device_info.h"
+#include "file_stat.h"
+
+namespace {
+
+const char* const rule_name_list[] = {"oldest", "newest", "shortest", "fastest"}; // In order of AutoPolicy::Rule
+
+}
+
+void AutoPolicy::add_dir(QString path, int priority)
+{
+    // Dirs above scanned roots are interned too, so dir which is not found has no dups below it
+    PathId dir = paths.find(QDir::fromNativeSeparators(path));
+    if (dir != PathStore::NoPath) dir_prio.insert(dir, priority);
+}
+
+bool AutoPolicy::rule_from_name(QString name, Rule& rule)
+{
+    for (int i = 0; i < int(std::size(rule_name_list)); ++i)
+    {
+        if (name == rule_name_list[i]) {rule = Rule(i); return true;}
+    }
+    return false;
+}
+
+QStringList AutoPolicy::rule_names()
+{
+    QStringList result;
+    for (auto name : rule_name_list) result << name;
+    return result;
+}
+
+bool AutoPolicy::is_rotational(QString path, quint64 dev)
+{
+    QMutexLocker<QMutex> l(&devices_mutex);
+    auto iter = rotational.constFind(dev);
+    if (iter == rotational.cend()) iter = rotational.insert(dev, is_rotational_device(path, dev));
+    return *iter;
+}
+
+std::vector<AutoPolicy::Decision> AutoPolicy::evaluate(const std::vector<Member>& members, const std::vector<size_t>& begins)
+{
+    std::vector<Decision> result(members.size(), PD_None);
+    if (empty() || begins.size() < 2) return result;
+    size_t groups = begins.size() - 1;
+    bool use_dirs = !dir_prio.isEmpty();
+    int width = int(use_dirs) + int(rules.size());
+
+    std::vector<size_t> chunks; // First group of each task
+    for (size_t g = 0; g < groups; g += CHUNK) chunks.push_back(g);
+
+    // Dir priorities are resolved once per dir - files of the same dir don't walk up again
+    std::vector<PathId> dirs(members.size());
+    QHash<PathId, int> resolved;
+    if (use_dirs)
+    {
+        QtConcurrent::blockingMap(chunks, [&](size_t first) {
+            for (size_t i = begins[first]; i < begins[std::min(first + CHUNK, groups)]; ++i) dirs[i] = paths.parent(members[i].file);
+        });
+        QVector<PathId> chain;
+        for (auto dir : dirs)
+        {
+            if (resolved.contains(dir)) continue;
+            int prio = 0;
+            chain.clear();
+            for (PathId d = dir; d != PathStore::NoPath; d = paths.parent(d))
+            {
+                if (auto iter = resolved.constFind(d); iter != resolved.cend()) {prio = *iter; break;}
+                chain << d;
+                if (auto iter = dir_prio.constFind(d); iter != dir_prio.cend()) {prio = *iter; break;}
+            }
+            for (auto d : chain) resolved.insert(d, prio);
+        }
+    }
+
+    bool stat_needed = needs_stat(), path_needed = stat_needed || rules.contains(AR_ShortestPath);
+    QtConcurrent::blockingMap(chunks, [&](size_t first) {
+        std::vector<qint64> scores;
+        for (size_t g = first; g < std::min(first + CHUNK, groups); ++g)
+        {
+            size_t begin = begins[g], count = begins[g + 1] - begin;
+            scores.assign(count * width, 0);
+            bool valid = true;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Member& m = members[begin + i];
+                qint64* score = &scores[i * width];
+                if (use_dirs) *score++ = resolved.value(dirs[begin + i]);
+                QString path;
+                FileStat st;
+                if (path_needed) path = paths.path(m.file);
+                if (stat_needed && !get_file_stat(path, st)) {valid = false; break;}
+                for (auto rule : rules)
+                {
+                    switch (rule)
+                    {
+                        case AR_Oldest: *score++ = -st.mtime_ns; break;
+                        case AR_Newest: *score++ = st.mtime_ns; break;
+                        case AR_ShortestPath: *score++ = -path.size(); break;
+                        case AR_FastestDevice: *score++ = is_rotational(path, st.dev) ? 0 : 1; break;
+                    }
+                }
+            }
+            if (valid) decide(scores.data(), &members[begin], count, width, &result[begin]);
+        }
+    });
+    return result;
+}
+
+void AutoPolicy::decide(const qint64* scores, const Member* members, size_t count, int width, Decision* result)
+{
+    auto less = [&](size_t a, size_t b) {
+        return std::lexicographical_compare(scores + a * width, scores + (a + 1) * width, scores + b * width, scores + (b + 1) * width);
+    };
+    auto equal = [&](size_t a, size_t b) {return std::equal(scores + a * width, scores + (a + 1) * width, scores + b * width);};
+
+    const size_t none = count;
+    size_t top = none, keep = none; // Best undecided file, best kept file
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t& best = members[i].kept ? keep : top;
+        if (best == none || less(best, i)) best = i;
+    }
+    if (top == none) return;
+    size_t total_top = 0;
+    for (size_t i = 0; i < count; ++i) total_top += !members[i].kept && equal(i, top);
+
+    Decision top_decision = PD_None;
+    if (keep != none && equal(keep, top)) top_decision = PD_Delete; else // Already 'Keep' file at top score - use it and discard all other
+    if (total_top == 1) top_decision = PD_Keep; // Exactly one file at top score - keep it
+    // More than one - let's user decide
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!members[i].kept) result[i] = less(i, top) ? PD_Delete : top_decision;
+    }
+}
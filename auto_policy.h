@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <vector>
+
+#include "path_store.h"
+
+// Automatic resolution of dup groups (AutoDir). Policy is compiled against PathStore: listed dirs become ids, priority of
+// each dir of dups is resolved once (it is the one of its nearest listed parent, 0 if none). Then all groups are scored and
+// decided in parallel. Score of file is tuple: dir priority (if dirs are listed), then extra rules in order of adding -
+// next rule only breaks ties of previous ones.
+class AutoPolicy {
+public:
+    enum Rule {
+        AR_Oldest,        // Keep file with oldest modification time
+        AR_Newest,
+        AR_ShortestPath,
+        AR_FastestDevice  // Keep file on SSD rather than on spinning disk
+    };
+
+    enum Decision {
+        PD_None,    // Left to user
+        PD_Keep,
+        PD_Delete
+    };
+
+    struct Member {
+        PathId file = PathStore::NoPath;
+        bool kept = false; // Already kept by user - not decided, but other files with lower score are deleted
+    };
+
+    AutoPolicy(const PathStore& paths) : paths(paths) {}
+
+    void add_dir(QString path, int priority);
+    void add_rule(Rule rule) {rules << rule;}
+    bool empty() const {return dir_prio.isEmpty() && rules.isEmpty();}
+
+    static bool rule_from_name(QString name, Rule& rule); // oldest, newest, shortest, fastest
+    static QStringList rule_names();
+
+    // Members of group 'i' are members[begins[i]] ... members[begins[i + 1] - 1]. Return decision for each member (PD_None
+    // for kept ones). Group with file which can't be stat'ed (when rule needs it) is left to user.
+    std::vector<Decision> evaluate(const std::vector<Member>& members, const std::vector<size_t>& begins);
+
+    // Policy for one group. Files below top score are deleted. At top score single file is kept (or deleted, if some kept
+    // file has this score), several files are left to user.
+    static void decide(const qint64* scores, const Member* members, size_t count, int width, Decision* result);
+
+private:
+    static constexpr size_t CHUNK = 4096; // Groups per parallel task
+
+    const PathStore& paths;
+    QHash<PathId, int> dir_prio; // Listed dirs
+    QVector<Rule> rules;
+
+    QMutex devices_mutex;
+    QHash<quint64, bool> rotational; // <dev> -> spinning disk
+
+    bool needs_stat() const {return rules.contains(AR_Oldest) || rules.contains(AR_Newest) || rules.contains(AR_FastestDevice);}
+    bool is_rotational(QString path, quint64 dev);
+};
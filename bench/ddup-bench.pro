@@ -0,0 +1,32 @@
+# Benchmarks (Linux): qmake6 && make && ./ddup-bench gen /tmp/tree && ./ddup-bench run /tmp/tree
+TEMPLATE = app
+TARGET = ddup-bench
+QT = core gui concurrent # gui - icons of dir tree model
+CONFIG += c++20 console release precompile_header
+CONFIG -= app_bundle
+
+PRECOMPILED_HEADER = ../stdafx.h
+INCLUDEPATH += ..
+
+HEADERS = \
+    tree_gen.h \
+    ../scan_thread.h \
+    ../dir_tree_model.h
+
+SOURCES = \
+    ddup_bench.cpp \
+    tree_gen.cpp \
+    ../scan_thread.cpp \
+    ../auto_policy.cpp \
+    ../fast_hash.cpp \
+    ../hash_backend.cpp \
+    ../hash_stages.cpp \
+    ../file_reader.cpp \
+    ../file_compare.cpp \
+    ../file_stat.cpp \
+    ../hash_cache.cpp \
+    ../uring_reader.cpp \
+    ../device_info.cpp \
+    ../dir_reader.cpp \
+    ../path_store.cpp \
+    ../dir_tree_model.cpp
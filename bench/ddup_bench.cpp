@@ -0,0 +1,371 @@
+#include "stdafx.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+
+#include <random>
+#include <stdio.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "auto_policy.h"
+#include "dir_reader.h"
+#include "digest_table.h"
+#include "dir_tree_model.h"
+#include "fast_hash.h"
+#include "file_reader.h"
+#include "hash_backend.h"
+#include "path_store.h"
+#include "scan_thread.h"
+#include "tree_gen.h"
+
+// Benchmarks of scanner parts on synthetic tree:
+//   ddup-bench gen <dir> [options] - create tree
+//   ddup-bench run <dir> [options] - measure enumeration, hashing, stores, full scan, UI-side ingestion and AutoDir
+//   ddup-bench check - known-answer test of FastHash128 kernels (also done before run)
+// Each line reports rate and peak RSS of process so far.
+
+namespace {
+
+double peak_rss_mb()
+{
+#ifdef Q_OS_LINUX
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0; // KB on Linux
+#else
+    return 0;
+#endif
+}
+
+qint64 current_rss()
+{
+#ifdef Q_OS_LINUX
+    QFile f("/proc/self/statm");
+    if (!f.open(QIODeviceBase::ReadOnly)) return 0;
+    auto fields = f.readAll().split(' ');
+    return fields.size() > 1 ? fields[1].toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+void report(const char* name, double secs, qint64 items, const char* item_name, qint64 bytes = -1)
+{
+    secs = std::max(secs, 1e-9);
+    printf("%-16s %10.3f s  %12.0f %s/s", name, secs, items / secs, item_name);
+    if (bytes >= 0) printf("  %9.1f MB/s", bytes / secs / (1 << 20));
+    printf("  peak RSS %.1f MB\n", peak_rss_mb());
+    fflush(stdout);
+}
+
+struct FileEntry {
+    PathId id;
+    qint64 size;
+};
+
+// Single thread walk with DirReader, interning paths as scanner does
+void bench_enumerate(QString root, PathStore& paths, std::vector<FileEntry>& files)
+{
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<PathId> stack{paths.intern(QFileInfo(root).absoluteFilePath())};
+    DirReader reader;
+    DirReader::Entry ent;
+    qint64 dirs = 0;
+    while (!stack.empty())
+    {
+        PathId dir = stack.back();
+        stack.pop_back();
+        ++dirs;
+        if (!reader.open(paths.path(dir))) continue;
+        while (reader.next(ent))
+        {
+            PathId id = paths.intern(dir, ent.name);
+            if (id == PathStore::NoPath) continue; // Store is full
+            if (ent.is_dir) stack.push_back(id);
+            else files.push_back(FileEntry{id, ent.st.size});
+        }
+    }
+    report("enumerate", timer.elapsed() / 1000.0, qint64(files.size()) + dirs, "entries");
+}
+
+void bench_hash(const PathStore& paths, const std::vector<FileEntry>& files, HashBackend backend)
+{
+    QElapsedTimer timer;
+    timer.start();
+    FileReader reader;
+    qint64 bytes = 0;
+    for (const auto& f : files)
+    {
+        if (!reader.open(paths.path(f.id))) continue;
+        Hasher hasher(backend);
+        if (reader.read(0, f.size, [&hasher](const char* data, qint64 size) {hasher.add(data, size);})) bytes += f.size;
+        hasher.result();
+    }
+    QByteArray name = ("hash " + hash_backend_name(backend)).toLatin1();
+    report(name.constData(), timer.elapsed() / 1000.0, qint64(files.size()), "files", bytes);
+}
+
+// Stage/dup stores: insert of mostly unique digests, then lookup of all of them
+void bench_stores(qint64 count)
+{
+    struct Slot {
+        PathId first = PathStore::NoPath;
+        qint32 group = -1;
+    };
+    std::mt19937_64 rng(1);
+    std::vector<Digest> keys(count);
+    for (auto& k : keys)
+    {
+        for (size_t i = 0; i < sizeof(k.bytes); i += 8)
+        {
+            quint64 v = rng();
+            memcpy(k.bytes + i, &v, std::min<size_t>(8, sizeof(k.bytes) - i));
+        }
+    }
+    qint64 rss = current_rss();
+    QElapsedTimer timer;
+    timer.start();
+    DigestTable<Slot> table;
+    for (qint64 i = 0; i < count; ++i) table.insert(keys[i]).first->first = PathId(i);
+    report("store insert", timer.elapsed() / 1000.0, count, "keys");
+    printf("%-16s %10.1f bytes/key\n", "store memory", double(current_rss() - rss) / std::max<qint64>(1, count));
+
+    timer.restart();
+    qint64 found = 0;
+    for (const auto& k : keys) found += table.find(k) != nullptr;
+    report("store find", timer.elapsed() / 1000.0, found, "keys");
+}
+
+// Full scan as UI runs it. Returns found dups (ids in scanner's path store).
+std::vector<ScanThread::DupResult> bench_scan(ScanThread& scanner, QString root, int threads)
+{
+    qint64 rss = current_rss();
+    ScanState state{};
+    if (threads > 0) scanner.set_worker_count(threads);
+    QEventLoop loop;
+    QObject::connect(&scanner, &ScanThread::stat_update, &loop, [&](ScanState s) {
+        state = s;
+        if (s.total_dirs && !s.dirs_to_proceed) loop.quit();
+    }, Qt::QueuedConnection);
+    QElapsedTimer timer;
+    timer.start();
+    scanner.start();
+    scanner.scan_dir(root);
+    loop.exec();
+    double secs = timer.elapsed() / 1000.0;
+    scanner.force_exit();
+    scanner.wait();
+
+    report("scan", secs, qint64(state.total_files), "files", state.bytes_read);
+    printf("%-16s %10.1f bytes/file  (%zu dups, %zu false dups, %zu hardlinks)\n", "scan memory",
+        double(current_rss() - rss) / std::max<size_t>(1, state.total_files), state.total_dups, state.total_false_dups, state.total_hardlinks);
+
+    std::vector<ScanThread::DupResult> results;
+    scanner.take_results(results);
+    return results;
+}
+
+// QDupFind::scan_take_results without view: all_files/files_by_hash insertion and dir tree model nodes
+void bench_ingest(const std::vector<ScanThread::DupResult>& results, const PathStore& paths)
+{
+    struct Info {
+        QByteArray hash;
+        int file_mode = 0;
+    };
+    using Map = QMap<PathId, Info>;
+    Map all_files;
+    QMultiHash<QByteArray, Map::iterator> files_by_hash;
+    DirTreeModel model(paths);
+
+    qint64 rss = current_rss();
+    QElapsedTimer timer;
+    timer.start();
+    files_by_hash.reserve(qsizetype(results.size()));
+    for (const auto& res : results)
+    {
+        auto ptr = all_files.insert(res.file, Info{res.hash});
+        files_by_hash.insert(res.hash, ptr);
+        model.add_file(res.file);
+    }
+    report("ui ingest", timer.elapsed() / 1000.0, qint64(results.size()), "dups");
+    printf("%-16s %10.1f bytes/dup\n", "ui memory", double(current_rss() - rss) / std::max<size_t>(1, results.size()));
+
+    // Expanding whole tree is the worst case for view - all rows are materialized
+    timer.restart();
+    std::vector<QModelIndex> stack{QModelIndex()};
+    qint64 rows = 0;
+    while (!stack.empty())
+    {
+        QModelIndex idx = stack.back();
+        stack.pop_back();
+        if (model.canFetchMore(idx)) model.fetchMore(idx);
+        for (int i = 0, count = model.rowCount(idx); i < count; ++i) stack.push_back(model.index(i, 0, idx));
+        rows += model.rowCount(idx);
+    }
+    report("ui expand all", timer.elapsed() / 1000.0, rows, "rows");
+}
+
+// Computational part of AutoDir: policy compilation and decision for every group. First level subdirs get priorities
+// in order of names. Second pass adds rules which need file stat.
+void bench_autodir(QString root, const std::vector<ScanThread::DupResult>& results, const PathStore& paths)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QHash<QByteArray, QVector<PathId>> groups;
+    for (const auto& res : results) groups[res.hash] << res.file;
+    std::vector<AutoPolicy::Member> members;
+    std::vector<size_t> begins{0};
+    for (const auto& files : groups)
+    {
+        for (auto f : files) members.push_back({f, false});
+        begins.push_back(members.size());
+    }
+    QStringList subdirs = QDir(root).entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+
+    qint64 decided = 0;
+    for (bool with_rules : {false, true})
+    {
+        timer.restart();
+        AutoPolicy policy(paths);
+        int cur_prio = int(subdirs.size());
+        for (const auto& d : subdirs) policy.add_dir(QFileInfo(root + "/" + d).absoluteFilePath(), cur_prio--);
+        if (with_rules)
+        {
+            policy.add_rule(AutoPolicy::AR_FastestDevice);
+            policy.add_rule(AutoPolicy::AR_Oldest);
+        }
+        decided = 0;
+        for (auto d : policy.evaluate(members, begins)) decided += d != AutoPolicy::PD_None;
+        report(with_rules ? "autodir+rules" : "autodir", timer.elapsed() / 1000.0, qint64(results.size()), "files");
+    }
+    printf("%-16s %10lld groups, %lld files decided\n", "autodir result", qint64(groups.size()), decided);
+}
+
+// Every FastHash128 kernel this CPU supports must give the same known digests. Inputs cover empty, partial stripe,
+// stripe boundary, partial block and many blocks.
+bool check_kernels()
+{
+    static const struct {
+        size_t size;
+        const char* digest;
+    } answers[] = {
+        {0, "01381490df8fb284b9845e117ea03a8a"},
+        {1, "d1137199106c2dc90144ad5c74cb420c"},
+        {63, "1f4ec2226aacc7bbaf50e0dc3b9d4992"},
+        {64, "68362c4a85fef27d7d7cab1a4980e07c"},
+        {1023, "0e69ac21545fb7d5c1f16c611e6c93e4"},
+        {1 << 20, "a5923a6ae149ea76bb09336b0da403cf"},
+    };
+    QByteArray data(1 << 20, Qt::Uninitialized);
+    for (qsizetype i = 0; i < data.size(); ++i) data[i] = char(i * 131 + 7);
+
+    bool ok = true;
+    for (const char* kernel : FastHash128::supported_kernels())
+    {
+        for (const auto& a : answers)
+        {
+            FastHash128 h(kernel);
+            h.add(data.constData(), a.size);
+            QByteArray digest(FastHash128::DIGEST_SIZE, Qt::Uninitialized);
+            h.result((unsigned char*)digest.data());
+            if (digest.toHex() != a.digest)
+            {
+                fprintf(stderr, "Kernel %s: digest of %zu bytes is %s, expected %s\n", kernel, a.size,
+                    digest.toHex().constData(), a.digest);
+                ok = false;
+            }
+        }
+    }
+    printf("%-16s %s (selected %s)\n", "hash kernels", ok ? "ok" : "FAILED", FastHash128::kernel_name());
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("ddup-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Scanner benchmarks. 'gen <dir>' creates synthetic tree, 'run <dir>' measures it, "
+        "'check' tests hash kernels.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "gen, run or check");
+    parser.addPositionalArgument("dir", "Tree root");
+    TreeGenParams p;
+    QCommandLineOption seed_opt("seed", "gen: random seed", "n", QString::number(p.seed));
+    QCommandLineOption files_opt("files", "gen: number of files", "n", QString::number(p.files));
+    QCommandLineOption min_size_opt("min-size", "gen: min file size", "size", QString::number(p.min_size));
+    QCommandLineOption max_size_opt("max-size", "gen: max file size (sizes are log-uniform)", "size", QString::number(p.max_size));
+    QCommandLineOption dup_opt("dups", "gen: ratio of dups", "ratio", QString::number(p.dup_ratio));
+    QCommandLineOption false_dup_opt("false-dups", "gen: ratio of files with the same size, head and tail as other", "ratio", QString::number(p.false_dup_ratio));
+    QCommandLineOption hardlink_opt("hardlinks", "gen: ratio of hardlinks", "ratio", QString::number(p.hardlink_ratio));
+    QCommandLineOption fanout_opt("fanout", "gen: subdirs per dir", "n", QString::number(p.fanout));
+    QCommandLineOption per_dir_opt("files-per-dir", "gen: files per dir", "n", QString::number(p.files_per_dir));
+    QCommandLineOption threads_opt("threads", "run: scan workers (default - number of CPUs)", "n", "0");
+    QCommandLineOption skip_hash_opt("skip-hash", "run: don't measure hash backends on whole tree");
+    parser.addOptions({seed_opt, files_opt, min_size_opt, max_size_opt, dup_opt, false_dup_opt, hardlink_opt, fanout_opt,
+        per_dir_opt, threads_opt, skip_hash_opt});
+    parser.process(app);
+
+    auto args = parser.positionalArguments();
+    if (args.size() == 1 && args[0] == "check") return check_kernels() ? 0 : 1;
+    if (args.size() != 2) parser.showHelp(1);
+    QString root = QFileInfo(args[1]).absoluteFilePath();
+
+    if (args[0] == "gen")
+    {
+        p.seed = parser.value(seed_opt).toULongLong();
+        p.files = parser.value(files_opt).toLongLong();
+        if (!parse_size(parser.value(min_size_opt), p.min_size) || !parse_size(parser.value(max_size_opt), p.max_size))
+        {
+            fprintf(stderr, "Bad size\n");
+            return 1;
+        }
+        p.dup_ratio = parser.value(dup_opt).toDouble();
+        p.false_dup_ratio = parser.value(false_dup_opt).toDouble();
+        p.hardlink_ratio = parser.value(hardlink_opt).toDouble();
+        p.fanout = parser.value(fanout_opt).toInt();
+        p.files_per_dir = parser.value(per_dir_opt).toInt();
+
+        QElapsedTimer timer;
+        timer.start();
+        TreeGenStat stat;
+        QString error;
+        if (!generate_tree(root, p, stat, error))
+        {
+            fprintf(stderr, "%s\n", qPrintable(error));
+            return 1;
+        }
+        report("gen", timer.elapsed() / 1000.0, stat.files, "files", stat.bytes);
+        printf("%lld files in %lld dirs, %.1f MB: %lld dups, %lld false dups, %lld hardlinks\n", stat.files, stat.dirs,
+            stat.bytes / double(1 << 20), stat.dups, stat.false_dups, stat.hardlinks);
+        return 0;
+    }
+    if (args[0] != "run") parser.showHelp(1);
+    if (!check_kernels()) return 1; // Hash rates of wrong kernel are meaningless
+
+    {
+        PathStore paths;
+        std::vector<FileEntry> files;
+        bench_enumerate(root, paths, files);
+        if (!parser.isSet(skip_hash_opt))
+        {
+            for (auto backend : {HB_Fast, HB_Md5, HB_Sha256}) bench_hash(paths, files, backend);
+        }
+        bench_stores(std::max<qint64>(qint64(files.size()), 1000000));
+    }
+    ScanThread scanner(nullptr);
+    auto results = bench_scan(scanner, root, parser.value(threads_opt).toInt());
+    bench_ingest(results, scanner.get_paths());
+    bench_autodir(root, results, scanner.get_paths());
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "stdafx.h"
+
+#include <QDir>
+
+#include <cmath>
+#include <vector>
+
+#ifndef Q_OS_WIN
+#include <unistd.h>
+#endif
+
+#include "tree_gen.h"
+
+namespace {
+
+quint64 splitmix64(quint64& state)
+{
+    quint64 z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+double uniform(quint64& state) {return (splitmix64(state) >> 11) * (1.0 / (1ull << 53));}
+
+// File contents: pseudo random stream of 'seed', optionally with one flipped byte
+struct Content {
+    quint64 seed;
+    qint64 size;
+    qint64 flip = -1;
+    QString path; // First file with these contents
+};
+
+bool write_content(const QString& path, const Content& c)
+{
+    QFile f(path);
+    if (!f.open(QIODeviceBase::WriteOnly)) return false;
+    static constexpr qint64 BLOCK = 64 * 1024;
+    std::vector<quint64> block(BLOCK / sizeof(quint64));
+    quint64 state = c.seed;
+    for (qint64 offset = 0; offset < c.size; offset += BLOCK)
+    {
+        for (auto& v : block) v = splitmix64(state);
+        qint64 part = std::min(BLOCK, c.size - offset);
+        auto data = (char*)block.data();
+        if (c.flip >= offset && c.flip < offset + part) data[c.flip - offset] ^= 0x5A;
+        if (f.write(data, part) != part) return false;
+    }
+    return true;
+}
+
+// Dirs are numbered in breadth first order of 'fanout'-ary tree: 0 - root, 1..fanout - its children and so on
+QString dir_path(QString root, qint64 index, int fanout)
+{
+    QStringList parts;
+    for (; index > 0; index = (index - 1) / fanout) parts.prepend(QString("d%1").arg((index - 1) % fanout, 2, 10, QChar('0')));
+    parts.prepend(root);
+    return parts.join('/');
+}
+
+}
+
+bool generate_tree(QString root, const TreeGenParams& p, TreeGenStat& stat, QString& error)
+{
+    stat = TreeGenStat();
+    if (p.files < 0 || p.min_size < 1 || p.max_size < p.min_size || p.fanout < 1 || p.files_per_dir < 1)
+    {
+        error = "Bad parameters";
+        return false;
+    }
+    QDir dir(root);
+    if (dir.exists() && !dir.isEmpty()) {error = "'" + root + "' is not empty"; return false;}
+
+    quint64 rng = p.seed;
+    std::vector<Content> contents;
+    qint64 last_dir = -1;
+    for (qint64 i = 0; i < p.files; ++i)
+    {
+        qint64 dir_index = i / p.files_per_dir;
+        QString dir_name = dir_path(root, dir_index, p.fanout);
+        if (dir_index != last_dir)
+        {
+            if (!QDir().mkpath(dir_name)) {error = "Can't create '" + dir_name + "'"; return false;}
+            ++stat.dirs;
+            last_dir = dir_index;
+        }
+        QString path = dir_name + QString("/f%1.bin").arg(i, 7, 10, QChar('0'));
+
+        double r = uniform(rng);
+        if (!contents.empty() && r < p.hardlink_ratio)
+        {
+            const auto& src = contents[splitmix64(rng) % contents.size()];
+#ifndef Q_OS_WIN
+            if (::link(QFile::encodeName(src.path).constData(), QFile::encodeName(path).constData()) != 0)
+#else
+            if (!QFile::link(src.path, path))
+#endif
+            {
+                error = "Can't create hardlink '" + path + "'";
+                return false;
+            }
+            ++stat.hardlinks;
+            ++stat.files;
+            continue;
+        }
+        r -= p.hardlink_ratio;
+
+        Content c;
+        if (!contents.empty() && r < p.dup_ratio)
+        {
+            c = contents[splitmix64(rng) % contents.size()];
+            ++stat.dups;
+        }
+        else if (!contents.empty() && r < p.dup_ratio + p.false_dup_ratio)
+        {
+            c = contents[splitmix64(rng) % contents.size()];
+            qint64 flip = c.size / 4 + qint64(splitmix64(rng) % quint64(c.size / 2 + 1)); // Head and tail are the same
+            c.flip = flip == c.flip ? (flip + 1) % c.size : flip; // Differs from source even if it is false dup itself
+            c.path = path;
+            contents.push_back(c);
+            ++stat.false_dups;
+        }
+        else
+        {
+            double log_size = std::log(double(p.min_size)) + uniform(rng) * (std::log(double(p.max_size)) - std::log(double(p.min_size)));
+            c = Content{splitmix64(rng), std::clamp<qint64>(qint64(std::exp(log_size)), p.min_size, p.max_size), -1, path};
+            contents.push_back(c);
+        }
+        if (!write_content(path, c)) {error = "Can't write '" + path + "'"; return false;}
+        stat.bytes += c.size;
+        ++stat.files;
+    }
+    return true;
+}
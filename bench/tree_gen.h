@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QString>
+
+// Deterministic generator of file trees for benchmarks: same parameters give the same tree (names and contents).
+struct TreeGenParams {
+    quint64 seed = 1;
+    qint64 files = 10000;
+    qint64 min_size = 1024;      // File sizes are log-uniform in [min_size, max_size]
+    qint64 max_size = 1 << 20;
+    double dup_ratio = 0.2;       // Files which are copies of some earlier file
+    double false_dup_ratio = 0.1; // Same size, head and tail as earlier file, but one byte in the middle differs
+    double hardlink_ratio = 0.02; // Hardlinks to earlier file
+    int fanout = 8;               // Subdirs per dir
+    int files_per_dir = 32;
+};
+
+struct TreeGenStat {
+    qint64 files = 0;
+    qint64 dirs = 0;
+    qint64 bytes = 0;
+    qint64 dups = 0;
+    qint64 false_dups = 0;
+    qint64 hardlinks = 0;
+};
+
+// Create tree under 'root' (must not exist or be empty). Return false and set 'error' on failure.
+bool generate_tree(QString root, const TreeGenParams&, TreeGenStat&, QString& error);
@@ -0,0 +1,250 @@
+#include "stdafx.h"
+
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <vector>
+
+#include "block_share.h"
+#include "file_compare.h"
+
+namespace {
+
+constexpr int LINK_TRIES = 100; // Temporary names tried before giving up
+
+// Replace 'file' by hardlink to 'source': link to temporary name in the same dir, then rename over file.
+// Existing file with temporary name is never touched - next name is tried.
+bool link_replace(QString source, QString file, QString& error)
+{
+    QString tmp;
+#ifdef Q_OS_WIN
+    for (int n = 0;; ++n)
+    {
+        tmp = file + ".ddup-link" + (n ? QString::number(n) : QString());
+        if (CreateHardLinkW((LPCWSTR)tmp.utf16(), (LPCWSTR)source.utf16(), NULL)) break;
+        DWORD code = GetLastError();
+        if (code != ERROR_ALREADY_EXISTS || n == LINK_TRIES) {error = qt_error_string(code); return false;}
+    }
+    if (!MoveFileExW((LPCWSTR)tmp.utf16(), (LPCWSTR)file.utf16(), MOVEFILE_REPLACE_EXISTING))
+    {
+        error = qt_error_string(GetLastError());
+        DeleteFileW((LPCWSTR)tmp.utf16());
+        return false;
+    }
+#else
+    QByteArray src = QFile::encodeName(source), dst = QFile::encodeName(file), tmp_name;
+    for (int n = 0;; ++n)
+    {
+        tmp_name = QFile::encodeName(file + ".ddup-link" + (n ? QString::number(n) : QString()));
+        if (link(src.constData(), tmp_name.constData()) == 0) break;
+        if (errno != EEXIST || n == LINK_TRIES) {error = qt_error_string(errno); return false;}
+    }
+    if (rename(tmp_name.constData(), dst.constData()) != 0)
+    {
+        error = qt_error_string(errno);
+        unlink(tmp_name.constData());
+        return false;
+    }
+#endif
+    return true;
+}
+
+#ifdef Q_OS_LINUX
+
+constexpr qint64 SHARE_CHUNK = 16 << 20; // Max length btrfs accepts in one request
+constexpr int SHARE_BATCH = 64; // Destinations per request (request must fit in one page)
+
+struct Dest {
+    int index; // In 'files'
+    int fd = -1;
+    bool active = true;
+};
+
+// Finish range for one destination after partial result. Return status like in file_dedupe_range_info.
+int dedupe_rest(int src, int fd, qint64 from, qint64 to)
+{
+    std::vector<char> buf(sizeof(file_dedupe_range) + sizeof(file_dedupe_range_info), 0);
+    auto range = (file_dedupe_range*)buf.data();
+    while (from < to)
+    {
+        range->src_offset = from;
+        range->src_length = to - from;
+        range->dest_count = 1;
+        range->info[0] = file_dedupe_range_info{};
+        range->info[0].dest_fd = fd;
+        range->info[0].dest_offset = from;
+        if (ioctl(src, FIDEDUPERANGE, range) != 0) return -errno;
+        if (range->info[0].status != FILE_DEDUPE_RANGE_SAME) return range->info[0].status;
+        if (!range->info[0].bytes_deduped) return -EIO; // No progress
+        from += range->info[0].bytes_deduped;
+    }
+    return FILE_DEDUPE_RANGE_SAME;
+}
+
+// Filesystem can't share these extents at all - hardlink is used instead. Other errors leave file alone.
+bool no_dedupe(int err)
+{
+    return err == EOPNOTSUPP || err == ENOTTY || err == EXDEV;
+}
+
+#endif
+
+}
+
+QVector<ShareResult> share_blocks(QString source, const QStringList& files, QStringList& errors)
+{
+    QVector<ShareResult> result(files.size(), SR_Failed);
+    QVector<bool> need_link(files.size(), true);
+
+#ifdef Q_OS_LINUX
+    int src = open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat src_st;
+    if (src < 0 || fstat(src, &src_st) != 0)
+    {
+        errors << "Can't open '" + source + "': " + qt_error_string(errno);
+        if (src >= 0) close(src);
+        return result;
+    }
+    for (qsizetype first = 0; first < files.size(); first += SHARE_BATCH)
+    {
+        std::vector<Dest> dests;
+        for (qsizetype i = first; i < std::min<qsizetype>(first + SHARE_BATCH, files.size()); ++i)
+        {
+            QByteArray name = QFile::encodeName(files[i]);
+            // Destination must be writable, unless we own it
+            int fd = open(name.constData(), O_RDWR | O_CLOEXEC);
+            if (fd < 0) fd = open(name.constData(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0)
+            {
+                errors << "Can't open '" + files[i] + "': " + qt_error_string(errno);
+                need_link[i] = false;
+                if (fd >= 0) close(fd);
+                continue;
+            }
+            if (st.st_dev == src_st.st_dev && st.st_ino == src_st.st_ino) // Already the same file
+            {
+                result[i] = SR_Hardlinked;
+                need_link[i] = false;
+                close(fd);
+                continue;
+            }
+            if (st.st_size != src_st.st_size)
+            {
+                result[i] = SR_Differs;
+                need_link[i] = false;
+                close(fd);
+                continue;
+            }
+            dests.push_back(Dest{int(i), fd});
+        }
+
+        std::vector<char> buf(sizeof(file_dedupe_range) + dests.size() * sizeof(file_dedupe_range_info), 0);
+        auto range = (file_dedupe_range*)buf.data();
+        std::vector<Dest*> active;
+        for (auto& d : dests) active.push_back(&d);
+        for (qint64 offset = 0; offset < src_st.st_size && !active.empty(); offset += SHARE_CHUNK)
+        {
+            qint64 length = std::min<qint64>(SHARE_CHUNK, src_st.st_size - offset);
+            range->src_offset = offset;
+            range->src_length = length;
+            range->dest_count = quint16(active.size());
+            range->reserved1 = 0;
+            range->reserved2 = 0;
+            for (size_t k = 0; k < active.size(); ++k)
+            {
+                range->info[k] = file_dedupe_range_info{};
+                range->info[k].dest_fd = active[k]->fd;
+                range->info[k].dest_offset = offset;
+            }
+            if (ioctl(src, FIDEDUPERANGE, range) != 0)
+            {
+                int err = errno;
+                for (auto d : active)
+                {
+                    d->active = false;
+                    if (no_dedupe(err)) continue; // Not supported by filesystem (or files are on different ones) - link them
+                    need_link[d->index] = false;
+                    errors << "Can't share '" + files[d->index] + "' with '" + source + "': " + qt_error_string(err);
+                }
+                active.clear();
+                break;
+            }
+            std::vector<Dest*> next;
+            for (size_t k = 0; k < active.size(); ++k)
+            {
+                const auto& info = range->info[k];
+                int status = info.status;
+                if (status == FILE_DEDUPE_RANGE_SAME && qint64(info.bytes_deduped) < length)
+                {
+                    status = dedupe_rest(src, active[k]->fd, offset + info.bytes_deduped, offset + length);
+                }
+                if (status == FILE_DEDUPE_RANGE_SAME) {next.push_back(active[k]); continue;}
+                active[k]->active = false;
+                if (status == FILE_DEDUPE_RANGE_DIFFERS)
+                {
+                    result[active[k]->index] = SR_Differs;
+                    need_link[active[k]->index] = false;
+                    errors << "File '" + files[active[k]->index] + "' differs from '" + source + "' - not shared";
+                }
+                else if (status < 0 && !no_dedupe(-status)) // Error of this destination only
+                {
+                    need_link[active[k]->index] = false;
+                    errors << "Can't share '" + files[active[k]->index] + "' with '" + source + "': " + qt_error_string(-status);
+                }
+            }
+            active.swap(next);
+        }
+        for (auto& d : dests)
+        {
+            if (d.active) {result[d.index] = SR_Shared; need_link[d.index] = false;}
+            close(d.fd);
+        }
+    }
+    close(src);
+#endif
+
+    // Unlike FIDEDUPERANGE, link has no check of contents - file changed after scan must not be replaced
+    QStringList to_link{source};
+    QVector<qsizetype> link_index;
+    qint64 size = QFileInfo(source).size();
+    for (qsizetype i = 0; i < files.size(); ++i)
+    {
+        if (!need_link[i]) continue;
+        if (QFileInfo(files[i]).size() != size)
+        {
+            result[i] = SR_Differs;
+            errors << "File '" + files[i] + "' differs from '" + source + "' - not linked";
+            continue;
+        }
+        to_link << files[i];
+        link_index << i;
+    }
+    if (link_index.isEmpty()) return result;
+    auto equal = compare_files(to_link, size);
+    for (qsizetype k = 0; k < link_index.size(); ++k)
+    {
+        qsizetype i = link_index[k];
+        if (!equal[k + 1])
+        {
+            result[i] = SR_Differs;
+            errors << "File '" + files[i] + "' differs from '" + source + "' (or can't be read) - not linked";
+            continue;
+        }
+        QString error;
+        if (link_replace(source, files[i], error)) result[i] = SR_Hardlinked;
+        else errors << "Can't replace '" + files[i] + "' by link to '" + source + "': " + error;
+    }
+    return result;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <QStringList>
+#include <QVector>
+
+enum ShareResult {
+    SR_Shared,     // Data extents are shared with source (FIDEDUPERANGE)
+    SR_Hardlinked, // File was replaced by hardlink to source (or already was one)
+    SR_Differs,    // Contents are not equal to source - file is not changed
+    SR_Failed      // File is not changed, see errors
+};
+
+// Alternative to delete: every path stays in place, but duplicates take no space.
+// On Linux extents are shared by FIDEDUPERANGE (btrfs, XFS, ...): kernel compares data under lock and shares it only if equal,
+// so file changed after scan is never lost and no separate verification pass is needed. Ranges are sent in big chunks, with
+// many destinations per request. Where it is not supported (other filesystems, other OS) file is compared with source byte
+// by byte and, if equal, atomically replaced by hardlink to source (owner, permissions and times become the ones of source).
+// Other errors of FIDEDUPERANGE leave file unchanged.
+// Error messages are appended to 'errors'.
+QVector<ShareResult> share_blocks(QString source, const QStringList& files, QStringList& errors);
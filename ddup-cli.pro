@@ -0,0 +1,28 @@
+# Console scanner (Linux, headless - no Gui/Widgets): qmake6 ddup-cli.pro && make && ./ddup-cli --help
+TEMPLATE = app
+TARGET = ddup-cli
+QT = core concurrent
+CONFIG += c++20 console release precompile_header
+CONFIG -= app_bundle
+
+PRECOMPILED_HEADER = stdafx.h
+
+HEADERS = \
+    scan_thread.h \
+    auto_policy.h
+
+SOURCES = \
+    ddup_cli.cpp \
+    scan_thread.cpp \
+    auto_policy.cpp \
+    fast_hash.cpp \
+    hash_backend.cpp \
+    hash_stages.cpp \
+    file_reader.cpp \
+    file_compare.cpp \
+    file_stat.cpp \
+    hash_cache.cpp \
+    uring_reader.cpp \
+    device_info.cpp \
+    dir_reader.cpp \
+    path_store.cpp
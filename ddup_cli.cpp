@@ -0,0 +1,240 @@
+#include "stdafx.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+#include <stdio.h>
+
+#include "scan_thread.h"
+#include "auto_policy.h"
+
+// Console front end of ScanThread for headless servers and cron jobs: scan roots, optionally apply AutoDir policy
+// (same as Actions/AutoDir in UI), write dup groups as JSON lines and print throughput statistics on exit.
+// Files are never changed - output is the plan.
+
+namespace {
+
+struct Group {
+    QByteArray hash;
+    QVector<PathId> files;
+};
+
+QString json_string(const QString& text)
+{
+    QString result = "\"";
+    for (QChar c : text)
+    {
+        if (c == '"' || c == '\\') result += '\\';
+        if (c.unicode() < 0x20) result += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+        else result += c;
+    }
+    return result + "\"";
+}
+
+void print_stat(const ScanState& s)
+{
+    double secs = std::max<qint64>(1, s.elapsed_ms) / 1000.0;
+    fprintf(stderr, "Time: %.1f s\n", secs);
+    fprintf(stderr, "Dirs: %zu, files: %zu (%.0f files/s)\n", s.total_dirs, s.total_files, s.total_files / secs);
+    fprintf(stderr, "Dups: %zu, false dups: %zu, hardlinks: %zu\n", s.total_dups, s.total_false_dups, s.total_hardlinks);
+    fprintf(stderr, "Read: %.1f MB (%.1f MB/s), hashed: %.1f MB (%.1f MB/s), cached hashes: %zu\n",
+        s.bytes_read / double(1 << 20), s.bytes_read / secs / (1 << 20),
+        s.bytes_hashed / double(1 << 20), s.bytes_hashed / secs / (1 << 20), s.cached_hashes);
+    if (s.verified_files) fprintf(stderr, "Verified: %zu files, %.1f MB\n", s.verified_files, s.verified_bytes / double(1 << 20));
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("ddup-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Find duplicate files. Dup groups are written as JSON lines: "
+        "{\"hash\": ..., \"size\": ..., \"files\": [{\"path\": ..., \"action\": \"keep\"|\"delete\"}]} "
+        "(action - only with --prio or --rule, missing if policy leaves file to user). "
+        "They are followed by hardlink groups: {\"hardlinks\": [<first seen link>, <other links to the same data>...]}. "
+        "Exit code: 0 - done, 1 - scan was not started (bad option, output, cache or checkpoint), 2 - done, but some files "
+        "or dirs could not be read.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("dirs", "Directories to scan", "<dir>...");
+    QCommandLineOption output_opt({"o", "output"}, "Write dup groups to <file> (default - stdout)", "file");
+    QCommandLineOption hash_opt("hash", "Hash backend: fast128 (default), md5, sha256", "backend", hash_backend_name(HB_Fast));
+    QCommandLineOption stages_opt("stages", "Hash stages, like \"" + hash_stages_to_string(default_hash_stages()) + "\"", "list");
+    QCommandLineOption verify_opt("verify", "Compare dups byte-by-byte before reporting them");
+    QCommandLineOption threads_opt("threads", "Number of scan workers", "n");
+    QCommandLineOption io_depth_opt("io-depth", "Batched reads in flight per worker (0 - off)", "n");
+    QCommandLineOption serial_opt("serial-hdd", "Scan each spinning disk by one worker");
+    QCommandLineOption min_size_opt("min-size", "Skip files smaller than <size> (like 4k, 1m)", "size");
+    QCommandLineOption exclude_opt("exclude", "Skip files and dirs with names matching <wildcard> (can be repeated)", "wildcard");
+    QCommandLineOption cache_opt("hash-cache", "Use persistent hash cache <file>", "file");
+    QCommandLineOption checkpoint_opt("checkpoint", "Resume scan from <file> if it exists, save progress to it (removed when scan completes)", "file");
+    QCommandLineOption prio_opt("prio", "AutoDir policy: dirs in order of priority, highest first (can be repeated). "
+        "<default> marks place of not listed dirs (lowest by default)", "dir");
+    QCommandLineOption rule_opt("rule", "AutoDir tie breaker: " + AutoPolicy::rule_names().join(", ") +
+        " (can be repeated, applied in order after dir priorities)", "rule");
+    QCommandLineOption progress_opt("progress", "Print progress to stderr every second");
+    parser.addOptions({output_opt, hash_opt, stages_opt, verify_opt, threads_opt, io_depth_opt, serial_opt, min_size_opt,
+        exclude_opt, cache_opt, checkpoint_opt, prio_opt, rule_opt, progress_opt});
+    parser.process(app);
+
+    auto fail = [](QString msg) {fprintf(stderr, "ddup-cli: %s\n", qPrintable(msg)); return 1;};
+
+    ScanThread scanner(nullptr);
+
+    if (parser.isSet(threads_opt)) scanner.set_worker_count(parser.value(threads_opt).toInt());
+    if (parser.isSet(io_depth_opt)) scanner.set_io_queue_depth(parser.value(io_depth_opt).toInt());
+    scanner.set_device_budgets(parser.isSet(serial_opt) ? 1 : 0, 0);
+    scanner.set_verify(parser.isSet(verify_opt));
+    scanner.set_exclude(parser.values(exclude_opt));
+    if (parser.isSet(min_size_opt))
+    {
+        qint64 size;
+        if (!parse_size(parser.value(min_size_opt), size)) return fail("Bad size '" + parser.value(min_size_opt) + "'");
+        scanner.set_min_file_size(size);
+    }
+    HashBackend backend;
+    if (!hash_backend_from_name(parser.value(hash_opt), backend)) return fail("Unknown hash backend '" + parser.value(hash_opt) + "'");
+    scanner.set_hash_backend(backend);
+    if (parser.isSet(stages_opt))
+    {
+        QVector<HashStage> stages;
+        if (!parse_hash_stages(parser.value(stages_opt), stages)) return fail("Bad hash stages '" + parser.value(stages_opt) + "'");
+        scanner.set_hash_stages(stages);
+    }
+    if (parser.isSet(cache_opt) && !scanner.set_hash_cache(parser.value(cache_opt)))
+    {
+        return fail("Can't open hash cache '" + parser.value(cache_opt) + "'");
+    }
+    bool resumed = false;
+    if (parser.isSet(checkpoint_opt))
+    {
+        QString path = parser.value(checkpoint_opt);
+        // Hash settings of resumed scan win over options
+        if (QFileInfo::exists(path) && !(resumed = scanner.resume(path))) return fail("Can't resume scan from '" + path + "'");
+        scanner.set_checkpoint(path);
+    }
+
+    QVector<AutoPolicy::Rule> rules;
+    for (QString name : parser.values(rule_opt))
+    {
+        AutoPolicy::Rule rule;
+        if (!AutoPolicy::rule_from_name(name, rule)) return fail("Unknown rule '" + name + "'");
+        rules << rule;
+    }
+
+    QFile out;
+    if (parser.isSet(output_opt))
+    {
+        out.setFileName(parser.value(output_opt));
+        if (!out.open(QIODeviceBase::WriteOnly | QIODeviceBase::Truncate)) return fail("Can't write '" + out.fileName() + "'");
+    }
+    else if (!out.open(stdout, QIODeviceBase::WriteOnly)) return fail("Can't write to stdout");
+
+    QStringList roots = parser.positionalArguments();
+    if (roots.isEmpty() && !resumed) parser.showHelp(1);
+    for (const auto& root : roots)
+    {
+        if (!QFileInfo(root).isDir() || QFileInfo(root).isSymLink()) return fail("'" + root + "' is not a directory");
+    }
+
+    bool show_progress = parser.isSet(progress_opt);
+    QElapsedTimer progress_timer;
+    progress_timer.start();
+    ScanState last_state{};
+    size_t errors = 0;
+
+    QObject::connect(&scanner, &ScanThread::error, &app, [&errors](QString msg) {
+        ++errors;
+        fprintf(stderr, "ERROR: %s\n", qPrintable(msg));
+    });
+    QObject::connect(&scanner, &ScanThread::stat_update, &app, [&](ScanState state) {
+        last_state = state;
+        if (show_progress && progress_timer.elapsed() >= 1000)
+        {
+            progress_timer.restart();
+            fprintf(stderr, "Dirs: %zu/%zu, files: %zu, dups: %zu, read: %.1f MB\n", state.total_dirs - state.dirs_to_proceed,
+                state.total_dirs, state.total_files, state.total_dups, state.bytes_read / double(1 << 20));
+        }
+        if (state.total_dirs && !state.dirs_to_proceed) app.exit(0); // All dirs (with their files) are done
+    }, Qt::QueuedConnection);
+
+    scanner.start();
+    for (const auto& root : roots) scanner.scan_dir(root);
+    app.exec();
+    scanner.force_exit();
+    scanner.wait();
+    // Scan is complete. Its checkpoint would make next run resume finished scan - new files would never be seen.
+    if (parser.isSet(checkpoint_opt)) QFile::remove(parser.value(checkpoint_opt));
+
+    // Groups in order of discovery
+    std::vector<ScanThread::DupResult> results;
+    scanner.take_results(results);
+    QHash<QByteArray, qsizetype> group_index;
+    QVector<Group> groups;
+    for (const auto& res : results)
+    {
+        auto iter = group_index.find(res.hash);
+        if (iter == group_index.end())
+        {
+            iter = group_index.insert(res.hash, groups.size());
+            groups << Group{res.hash, {}};
+        }
+        groups[*iter].files << res.file;
+    }
+
+    // Policy is compiled after scan - listed dirs must be interned already
+    const PathStore& paths = scanner.get_paths();
+    AutoPolicy policy(paths);
+    int cur_prio = parser.values(prio_opt).size();
+    for (QString dir : parser.values(prio_opt))
+    {
+        if (dir == "<default>") {cur_prio = -1; continue;}
+        policy.add_dir(QFileInfo(dir).absoluteFilePath(), cur_prio--);
+    }
+    for (auto rule : rules) policy.add_rule(rule);
+    std::vector<AutoPolicy::Member> members;
+    std::vector<size_t> begins{0};
+    for (const auto& g : groups)
+    {
+        for (auto file : g.files) members.push_back({file, false});
+        begins.push_back(members.size());
+    }
+    auto decisions = policy.evaluate(members, begins);
+
+    static const char* const actions[] = {nullptr, "keep", "delete"};
+    for (qsizetype gi = 0; gi < groups.size(); ++gi)
+    {
+        const auto& g = groups[gi];
+        QStringList names;
+        for (auto file : g.files) names << paths.path(file);
+        const auto* group_decisions = &decisions[begins[gi]];
+        QString line = QString("{\"hash\": \"%1\", \"size\": %2, \"files\": [").arg(QString::fromLatin1(g.hash.toHex()))
+            .arg(QFileInfo(names[0]).size());
+        for (qsizetype i = 0; i < names.size(); ++i)
+        {
+            if (i) line += ", ";
+            line += "{\"path\": " + json_string(names[i]);
+            if (group_decisions[i] != AutoPolicy::PD_None) line += QString(", \"action\": \"%1\"").arg(actions[group_decisions[i]]);
+            line += "}";
+        }
+        line += "]}\n";
+        out.write(line.toUtf8());
+    }
+    // Extra links are not hashed and are not in dup groups
+    auto hardlinks = scanner.get_hardlinks();
+    for (const auto& [primary, others] : hardlinks.asKeyValueRange())
+    {
+        QString line = "{\"hardlinks\": [" + json_string(primary);
+        for (const auto& link : others) line += ", " + json_string(link);
+        line += "]}\n";
+        out.write(line.toUtf8());
+    }
+    out.close();
+
+    fprintf(stderr, "Groups: %lld, hardlink groups: %lld\n", qint64(groups.size()), qint64(hardlinks.size()));
+    print_stat(last_state);
+    if (errors) fprintf(stderr, "Errors: %zu\n", errors);
+    return errors ? 2 : 0; // Results are written anyway, but scheduled job should see that scan was not complete
+}
@@ -0,0 +1,179 @@
+#include "stdafx.h"
+
+#include <QtConcurrent>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <queue>
+
+#include "delete_executor.h"
+#include "block_share.h"
+
+DeleteExecutor::DeleteExecutor(const PathStore& paths, QObject* parent) : QObject(parent), paths(paths)
+{
+    connect(&watcher, &QFutureWatcher<void>::finished, this, &DeleteExecutor::finished);
+}
+
+DeleteExecutor::~DeleteExecutor()
+{
+    cancel();
+    watcher.waitForFinished();
+}
+
+bool DeleteExecutor::start(std::vector<PathId> plan, std::vector<ShareGroup> shares)
+{
+    if (is_running()) return false;
+
+    // Sort by parent dir, so each dir is opened once per chunk
+    std::vector<std::pair<PathId, PathId>> by_dir; // <dir, file>
+    by_dir.reserve(plan.size());
+    for (auto file : plan) by_dir.emplace_back(paths.parent(file), file);
+    std::sort(by_dir.begin(), by_dir.end());
+
+    files.clear();
+    chunks.clear();
+    for (size_t i = 0; i < by_dir.size(); ++i)
+    {
+        if (chunks.empty() || chunks.back().dir != by_dir[i].first || chunks.back().end - chunks.back().begin == CHUNK)
+        {
+            chunks.push_back(Chunk{by_dir[i].first, i, i});
+        }
+        files.push_back(by_dir[i].second);
+        ++chunks.back().end;
+    }
+    share_groups = std::move(shares);
+    total = files.size();
+    for (const auto& g : share_groups) total += g.files.size();
+    next_chunk = 0;
+    processed = 0;
+    cancelled = false;
+    done.clear();
+    touched_dirs.clear();
+
+    watcher.setFuture(QtConcurrent::run([this]() {execute();}));
+    return true;
+}
+
+void DeleteExecutor::take_done(std::vector<PathId>& out)
+{
+    out.clear();
+    QMutexLocker l(&done_mutex);
+    out.swap(done);
+}
+
+void DeleteExecutor::execute()
+{
+    int count = std::clamp<int>(int(chunks.size() + share_groups.size()), 1, std::min(QThread::idealThreadCount(), MAX_THREADS));
+    QVector<QThread*> workers;
+    for (int i = 0; i < count; ++i)
+    {
+        workers << QThread::create([this]() {worker();});
+        workers.back()->start();
+    }
+    for (auto w : workers)
+    {
+        w->wait();
+        delete w;
+    }
+    remove_empty_dirs();
+}
+
+void DeleteExecutor::worker()
+{
+    while (!cancelled)
+    {
+        size_t idx = next_chunk++;
+        if (idx < chunks.size()) remove_dir(chunks[idx]);
+        else if (idx - chunks.size() < share_groups.size()) share_group(share_groups[idx - chunks.size()]);
+        else break;
+    }
+}
+
+void DeleteExecutor::remove_dir(const Chunk& chunk)
+{
+    std::vector<PathId> removed;
+    removed.reserve(chunk.end - chunk.begin);
+#ifdef Q_OS_LINUX
+    QString dir = paths.path(chunk.dir);
+    int fd = open(QFile::encodeName(dir).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        emit error("Can't open dir '" + dir + "': " + qt_error_string(errno));
+        processed += chunk.end - chunk.begin;
+        return;
+    }
+#endif
+    for (size_t i = chunk.begin; i < chunk.end && !cancelled; ++i)
+    {
+#ifdef Q_OS_LINUX
+        QByteArray name = QFile::encodeName(paths.name(files[i]));
+        if (unlinkat(fd, name.constData(), 0) == 0) removed.push_back(files[i]);
+        else emit error("Can't delete '" + paths.path(files[i]) + "': " + qt_error_string(errno));
+#else
+        QFile file(paths.path(files[i]));
+        if (file.remove()) removed.push_back(files[i]);
+        else emit error("Can't delete '" + file.fileName() + "': " + file.errorString());
+#endif
+        ++processed;
+    }
+#ifdef Q_OS_LINUX
+    close(fd);
+#endif
+
+    QMutexLocker l(&done_mutex);
+    done.insert(done.end(), removed.begin(), removed.end());
+    if (!removed.empty()) touched_dirs.push_back(chunk.dir);
+}
+
+// Group is not interrupted by cancel - kernel compares and shares each destination as one operation anyway
+void DeleteExecutor::share_group(const ShareGroup& group)
+{
+    QStringList names;
+    for (auto file : group.files) names << paths.path(file);
+    QStringList errors;
+    auto result = share_blocks(paths.path(group.source), names, errors);
+    for (const auto& msg : errors) emit error(msg);
+    processed += group.files.size();
+
+    QMutexLocker l(&done_mutex);
+    for (qsizetype i = 0; i < group.files.size(); ++i)
+    {
+        if (result[i] == SR_Shared || result[i] == SR_Hardlinked) done.push_back(group.files[i]);
+    }
+}
+
+// Deepest dirs first, so dir emptied by removal of its last subdir is removed too (as QDir::rmpath does)
+void DeleteExecutor::remove_empty_dirs()
+{
+    auto depth = [this](PathId dir) {
+        int result = 0;
+        for (; dir != PathStore::NoPath; dir = paths.parent(dir)) ++result;
+        return result;
+    };
+    std::priority_queue<std::pair<int, PathId>> queue;
+    std::sort(touched_dirs.begin(), touched_dirs.end());
+    touched_dirs.erase(std::unique(touched_dirs.begin(), touched_dirs.end()), touched_dirs.end());
+    for (auto dir : touched_dirs) queue.emplace(depth(dir), dir);
+
+    PathId last = PathStore::NoPath;
+    while (!queue.empty())
+    {
+        auto [level, dir] = queue.top();
+        queue.pop();
+        if (dir == last) continue; // Same parent of several removed dirs
+        last = dir;
+        QString path = paths.path(dir);
+#ifdef Q_OS_LINUX
+        if (rmdir(QFile::encodeName(path).constData()) != 0) continue; // Not empty (or root) - it is not an error
+#else
+        if (!QDir().rmdir(path)) continue;
+#endif
+        PathId parent = paths.parent(dir);
+        if (parent != PathStore::NoPath && level > 2) queue.emplace(level - 1, parent); // Never remove root component
+    }
+}
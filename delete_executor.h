@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QObject>
+
+#include <atomic>
+#include <vector>
+
+#include "path_store.h"
+
+// Executes snapshot of delete plan out of GUI thread. Files are grouped by dir and removed by pool of workers
+// (on Linux by unlinkat relative to dir fd opened once per group). Dirs emptied by delete are removed after all
+// files in one bottom-up pass. In share mode dup groups are given to the same workers instead - each group is one
+// share_blocks call. Deleted (or shared) files are pulled by UI with take_done() on its own cadence.
+class DeleteExecutor : public QObject {
+    Q_OBJECT
+
+public:
+    DeleteExecutor(const PathStore& paths, QObject* parent = nullptr);
+    ~DeleteExecutor();
+
+    struct ShareGroup {
+        PathId source;         // Kept file
+        QVector<PathId> files; // Files which should share data with it
+    };
+
+    // Plan is not checked - only files are passed. Return false if previous plan is still in work.
+    bool start(std::vector<PathId> plan, std::vector<ShareGroup> shares = {});
+    void cancel() {cancelled = true;}
+    bool is_running() const {return watcher.isRunning();}
+
+    void take_done(std::vector<PathId>& out); // Files deleted or shared since last call
+    size_t get_total() const {return total;}
+    size_t get_processed() const {return processed;} // Done or failed
+
+signals:
+    void error(QString);
+    void finished();
+
+private:
+    static constexpr int MAX_THREADS = 8; // Unlink is bound by filesystem metadata locks, not by CPU
+    static constexpr size_t CHUNK = 256; // Max files of one dir given to worker at once
+
+    struct Chunk {
+        PathId dir;
+        size_t begin, end; // Range in 'files'
+    };
+
+    const PathStore& paths;
+    std::vector<PathId> files; // Sorted by dir
+    std::vector<Chunk> chunks;
+    std::vector<ShareGroup> share_groups;
+    std::atomic<size_t> next_chunk = 0; // Delete chunks, then share groups
+    std::atomic<size_t> processed = 0;
+    size_t total = 0;
+    std::atomic<bool> cancelled = false;
+
+    QMutex done_mutex;
+    std::vector<PathId> done;
+    std::vector<PathId> touched_dirs; // Dirs of deleted files - candidates for rmdir. Under done_mutex.
+
+    QFutureWatcher<void> watcher;
+
+    void execute();
+    void worker();
+    void remove_dir(const Chunk&);
+    void share_group(const ShareGroup&);
+    void remove_empty_dirs();
+};
@@ -0,0 +1,53 @@
+#include "stdafx.h"
+
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#include <QStorageInfo>
+#elif defined(Q_OS_LINUX)
+#include <sys/sysmacros.h>
+#endif
+
+#include "device_info.h"
+
+#ifdef Q_OS_WIN
+
+bool is_rotational_device(QString path, quint64)
+{
+    // Volume name like "\\?\Volume{...}\" - without trailing slash it opens volume itself
+    QString volume = QString::fromUtf8(QStorageInfo(path).device());
+    if (volume.endsWith('\\')) volume.chop(1);
+    if (volume.isEmpty()) return false;
+    HANDLE h = CreateFileW((LPCWSTR)volume.utf16(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    STORAGE_PROPERTY_QUERY query = {StorageDeviceSeekPenaltyProperty, PropertyStandardQuery};
+    DEVICE_SEEK_PENALTY_DESCRIPTOR result = {};
+    DWORD size = 0;
+    bool ok = DeviceIoControl(h, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &result, sizeof(result), &size, NULL);
+    CloseHandle(h);
+    return ok && result.IncursSeekPenalty;
+}
+
+#elif defined(Q_OS_LINUX)
+
+bool is_rotational_device(QString, quint64 dev)
+{
+    // Partitions have no own queue - it belongs to parent disk. Devices without sysfs entry (btrfs, network, tmpfs) are not rotational.
+    QString sys = QString("/sys/dev/block/%1:%2").arg(major(dev)).arg(minor(dev));
+    for (QString queue : {sys + "/queue/rotational", QFileInfo(sys).canonicalFilePath() + "/../queue/rotational"})
+    {
+        QFile f(queue);
+        if (f.open(QIODeviceBase::ReadOnly)) return f.readAll().trimmed() == "1";
+    }
+    return false;
+}
+
+#else
+
+bool is_rotational_device(QString, quint64)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <QString>
+
+// True if device containing 'path' (with id 'dev' from FileStat) is a spinning disk. Unknown devices are treated as SSD.
+bool is_rotational_device(QString path, quint64 dev);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QByteArray>
+
+#include <string.h>
+#include <utility>
+#include <vector>
+
+#include "hash_backend.h"
+
+// Fixed size key of hash stores (digest of hash step or of whole file)
+struct Digest {
+    unsigned char bytes[HASH_DIGEST_SIZE];
+
+    static Digest from(const QByteArray& data)
+    {
+        Digest d = {};
+        memcpy(d.bytes, data.constData(), std::min<size_t>(data.size(), sizeof(d.bytes)));
+        return d;
+    }
+    QByteArray to_bytes() const {return QByteArray((const char*)bytes, sizeof(bytes));}
+    bool operator==(const Digest& other) const {return memcmp(bytes, other.bytes, sizeof(bytes)) == 0;}
+};
+
+// Flat open addressing table keyed by Digest (linear probing, no erase). Digests are uniformly distributed already,
+// so their first bytes are used as hash. Values live in slots - keep them small and put big data to side storage.
+// Pointers to values are valid only until next insert.
+template<class Value>
+class DigestTable {
+    struct Slot {
+        Digest key;
+        bool used = false;
+        Value value;
+    };
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    size_t index(const Digest& key) const
+    {
+        quint64 h;
+        memcpy(&h, key.bytes, sizeof(h));
+        return size_t(h) & (slots.size() - 1);
+    }
+
+    Slot& probe(const Digest& key)
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t idx = index(key);; idx = (idx + 1) & mask)
+        {
+            Slot& s = slots[idx];
+            if (!s.used || s.key == key) return s;
+        }
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old(std::max<size_t>(64, slots.size() * 2));
+        old.swap(slots);
+        for (auto& s : old)
+        {
+            if (s.used) probe(s.key) = std::move(s);
+        }
+    }
+
+public:
+    Value* find(const Digest& key)
+    {
+        if (slots.empty()) return nullptr;
+        Slot& s = probe(key);
+        return s.used ? &s.value : nullptr;
+    }
+
+    // Find value or insert default one. Second member is true if value was inserted
+    std::pair<Value*, bool> insert(const Digest& key)
+    {
+        if ((count + 1) * 4 > slots.size() * 3) grow(); // Load factor up to 3/4
+        Slot& s = probe(key);
+        if (s.used) return {&s.value, false};
+        s.used = true;
+        s.key = key;
+        ++count;
+        return {&s.value, true};
+    }
+
+    template<class Func>
+    void for_each(Func&& func)
+    {
+        for (auto& s : slots)
+        {
+            if (s.used) func(s.key, s.value);
+        }
+    }
+
+    size_t size() const {return count;}
+    void clear() {slots.clear(); count = 0;}
+};
@@ -0,0 +1,104 @@
+#include "stdafx.h"
+
+#ifdef Q_OS_LINUX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#else
+#include <QDirIterator>
+#endif
+
+#include "dir_reader.h"
+
+#ifdef Q_OS_LINUX
+
+namespace {
+
+struct linux_dirent64 {
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+}
+
+bool DirReader::open(QString dir)
+{
+    close();
+    fd = ::open(QFile::encodeName(dir).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    if (!buffer) buffer.reset(new char[BUFFER_SIZE]);
+    buffer_size = buffer_pos = 0;
+    return true;
+}
+
+void DirReader::close()
+{
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+bool DirReader::next(Entry& ent)
+{
+    while (fd >= 0)
+    {
+        if (buffer_pos >= buffer_size)
+        {
+            long got = syscall(SYS_getdents64, fd, buffer.get(), BUFFER_SIZE);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {close(); return false;}
+            buffer_size = int(got);
+            buffer_pos = 0;
+        }
+        auto de = (const linux_dirent64*)(buffer.get() + buffer_pos);
+        buffer_pos += de->d_reclen;
+
+        if (de->d_name[0] == '.') continue; // Hidden, '.' and '..'
+        if (de->d_type != DT_REG && de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) continue;
+        struct stat s;
+        if (fstatat(fd, de->d_name, &s, AT_SYMLINK_NOFOLLOW) != 0) continue; // Removed while we read dir
+        if (!S_ISREG(s.st_mode) && !S_ISDIR(s.st_mode)) continue;
+        ent.name = QFile::decodeName(de->d_name);
+        ent.is_dir = S_ISDIR(s.st_mode);
+        fill_file_stat(s, ent.st);
+        ent.has_stat = true;
+        return true;
+    }
+    return false;
+}
+
+#else
+
+bool DirReader::open(QString dir)
+{
+    iter.reset(new QDirIterator(dir, QDir::AllEntries | QDir::NoDotAndDotDot));
+    return QFileInfo(dir).isReadable();
+}
+
+void DirReader::close()
+{
+    iter.reset();
+}
+
+bool DirReader::next(Entry& ent)
+{
+    while (iter && iter->hasNext())
+    {
+        QFileInfo fi = iter->nextFileInfo();
+        if (fi.isSymLink() || (!fi.isFile() && !fi.isDir())) continue;
+        ent.name = fi.fileName();
+        ent.is_dir = fi.isDir();
+        ent.st = FileStat();
+        ent.st.size = fi.size();
+        ent.has_stat = false;
+        return true;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QString>
+
+#include <memory>
+
+#include "file_stat.h"
+
+class QDirIterator;
+
+// Streaming directory listing: memory used doesn't depend on number of entries.
+// On Linux entries are read by getdents64 in fixed size chunks and stat'ed relative to directory fd - one fstatat per file
+// or subdir, none for symlinks and special files (known from d_type). Elsewhere QDirIterator is used and only size is known.
+// Hidden entries are skipped, as QDir does by default.
+class DirReader {
+public:
+    struct Entry {
+        QString name;
+        bool is_dir = false; // Otherwise regular file. Symlinks and special files are not returned.
+        FileStat st;
+        bool has_stat = false; // All fields of 'st' are valid, otherwise only size
+    };
+
+    DirReader() = default;
+    ~DirReader() {close();}
+    DirReader(const DirReader&) = delete;
+    DirReader& operator=(const DirReader&) = delete;
+
+    bool open(QString dir);
+    void close();
+    bool next(Entry&); // Return false at end of dir or on error
+
+private:
+#ifdef Q_OS_LINUX
+    static constexpr int BUFFER_SIZE = 32*1024;
+    int fd = -1;
+    std::unique_ptr<char[]> buffer;
+    int buffer_size = 0;
+    int buffer_pos = 0;
+#else
+    std::unique_ptr<QDirIterator> iter;
+#endif
+};
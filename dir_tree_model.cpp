@@ -0,0 +1,252 @@
+#include "stdafx.h"
+
+#include <QMimeData>
+
+#include <algorithm>
+
+#include "dir_tree_model.h"
+
+DirTreeModel::DirTreeModel(const PathStore& paths, QObject* parent) : QAbstractItemModel(parent), paths(paths)
+{
+    nodes.emplace_back();
+    nodes[0].fetched = true;
+}
+
+void DirTreeModel::add_file(PathId file)
+{
+    if (file == PathStore::NoPath || node_of(file)) return;
+    if (node_by_path.size() < paths.size()) node_by_path.resize(paths.size() + paths.size() / 4);
+
+    // Nodes of dirs seen first time, from top
+    QVector<PathId> chain;
+    for (PathId id = file; id != PathStore::NoPath && !node_of(id); id = paths.parent(id)) chain << id;
+    quint32 parent = node_of(paths.parent(chain.back()));
+    for (auto iter = chain.rbegin(); iter != chain.rend(); ++iter)
+    {
+        quint32 n = quint32(nodes.size());
+        nodes.emplace_back();
+        nodes[n].path = *iter;
+        nodes[n].parent = parent;
+        nodes[parent].children.push_back(n);
+        node_by_path[*iter] = n;
+        parent = n;
+    }
+    nodes[parent].is_file = true;
+    ++files;
+    update_visible(parent, 1);
+}
+
+void DirTreeModel::set_hidden(PathId file, bool hidden)
+{
+    quint32 n = node_of(file);
+    if (!n || nodes[n].visible == quint32(!hidden)) return;
+    update_visible(n, hidden ? -1 : 1);
+}
+
+// Bottom up, so dir that just became visible gets its row before its children would need one
+void DirTreeModel::update_visible(quint32 n, int delta)
+{
+    for (; n; n = nodes[n].parent)
+    {
+        nodes[n].visible += delta;
+        sync(n);
+    }
+}
+
+void DirTreeModel::set_show_hidden(bool show)
+{
+    if (show == show_hidden) return;
+    beginResetModel();
+    show_hidden = show;
+    unfetch(0);
+    nodes[0].fetched = true;
+    auto& list = rows[0] = shown_children(0);
+    renumber(list, 0);
+    endResetModel();
+}
+
+void DirTreeModel::file_changed(PathId file)
+{
+    quint32 n = node_of(file);
+    if (!n || nodes[n].row < 0) return;
+    auto idx = node_index(n);
+    emit dataChanged(idx, idx, {Qt::DecorationRole});
+}
+
+PathId DirTreeModel::path_id(const QModelIndex& idx) const
+{
+    return nodes[node_of(idx)].path;
+}
+
+bool DirTreeModel::is_file(const QModelIndex& idx) const
+{
+    return nodes[node_of(idx)].is_file;
+}
+
+QModelIndex DirTreeModel::index_of(PathId file)
+{
+    quint32 n = node_of(file);
+    if (!n || !shown(n)) return {};
+    QVector<quint32> chain;
+    for (quint32 p = nodes[n].parent; p; p = nodes[p].parent) chain << p;
+    for (auto iter = chain.rbegin(); iter != chain.rend(); ++iter)
+    {
+        if (!nodes[*iter].fetched) fetchMore(node_index(*iter));
+    }
+    return node_index(n);
+}
+
+QVector<PathId> DirTreeModel::files_under(const QModelIndex& idx) const
+{
+    QVector<PathId> result;
+    std::vector<quint32> stack{node_of(idx)};
+    while (!stack.empty())
+    {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.is_file) result << node.path;
+        stack.insert(stack.end(), node.children.begin(), node.children.end());
+    }
+    return result;
+}
+
+std::vector<quint32> DirTreeModel::shown_children(quint32 n) const
+{
+    std::vector<std::pair<QString, quint32>> named;
+    for (auto c : nodes[n].children)
+    {
+        if (shown(c)) named.emplace_back(paths.name(nodes[c].path), c);
+    }
+    std::sort(named.begin(), named.end());
+    std::vector<quint32> result;
+    result.reserve(named.size());
+    for (const auto& ent : named) result.push_back(ent.second);
+    return result;
+}
+
+void DirTreeModel::renumber(std::vector<quint32>& list, size_t from)
+{
+    for (size_t i = from; i < list.size(); ++i) nodes[list[i]].row = qint32(i);
+}
+
+void DirTreeModel::sync(quint32 n)
+{
+    quint32 p = nodes[n].parent;
+    if (!nodes[p].fetched || shown(n) == (nodes[n].row >= 0)) return;
+    auto& list = rows[p];
+    if (shown(n))
+    {
+        QString name = paths.name(nodes[n].path);
+        auto pos = std::lower_bound(list.begin(), list.end(), name, [this](quint32 c, const QString& name) {
+            return paths.name(nodes[c].path) < name;
+        }) - list.begin();
+        beginInsertRows(node_index(p), int(pos), int(pos));
+        list.insert(list.begin() + pos, n);
+        renumber(list, pos);
+        endInsertRows();
+    }
+    else
+    {
+        int pos = nodes[n].row;
+        beginRemoveRows(node_index(p), pos, pos);
+        list.erase(list.begin() + pos);
+        nodes[n].row = -1;
+        renumber(list, pos);
+        unfetch(n);
+        endRemoveRows();
+    }
+}
+
+void DirTreeModel::unfetch(quint32 n)
+{
+    if (!nodes[n].fetched) return;
+    for (auto c : rows.take(n))
+    {
+        nodes[c].row = -1;
+        unfetch(c);
+    }
+    nodes[n].fetched = false;
+}
+
+QModelIndex DirTreeModel::index(int row, int column, const QModelIndex& parent) const
+{
+    quint32 p = node_of(parent);
+    if (column || row < 0 || !nodes[p].fetched) return {};
+    auto iter = rows.constFind(p);
+    if (iter == rows.cend() || size_t(row) >= iter->size()) return {};
+    return createIndex(row, 0, quintptr((*iter)[row]));
+}
+
+QModelIndex DirTreeModel::parent(const QModelIndex& idx) const
+{
+    if (!idx.isValid()) return {};
+    return node_index(nodes[node_of(idx)].parent);
+}
+
+int DirTreeModel::rowCount(const QModelIndex& parent) const
+{
+    if (parent.column() > 0) return 0;
+    auto iter = rows.constFind(node_of(parent));
+    return iter == rows.cend() ? 0 : int(iter->size());
+}
+
+bool DirTreeModel::hasChildren(const QModelIndex& parent) const
+{
+    quint32 p = node_of(parent);
+    if (!p) return rowCount(parent) > 0;
+    return !nodes[p].is_file && (show_hidden ? !nodes[p].children.empty() : nodes[p].visible > 0);
+}
+
+bool DirTreeModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !nodes[node_of(parent)].fetched && hasChildren(parent);
+}
+
+void DirTreeModel::fetchMore(const QModelIndex& parent)
+{
+    quint32 p = node_of(parent);
+    if (nodes[p].fetched) return;
+    auto list = shown_children(p);
+    if (list.empty()) {nodes[p].fetched = true; return;}
+    beginInsertRows(parent, 0, int(list.size()) - 1);
+    nodes[p].fetched = true;
+    renumber(list, 0);
+    rows[p] = std::move(list);
+    endInsertRows();
+}
+
+QVariant DirTreeModel::data(const QModelIndex& idx, int role) const
+{
+    if (!idx.isValid()) return {};
+    const Node& node = nodes[node_of(idx)];
+    switch (role)
+    {
+        case Qt::DisplayRole: return paths.name(node.path);
+        case Qt::ToolTipRole: return paths.path(node.path);
+        case Qt::DecorationRole: return node.is_file ? (file_icon ? file_icon(node.path) : QIcon()) : dir_icon;
+    }
+    return {};
+}
+
+Qt::ItemFlags DirTreeModel::flags(const QModelIndex& idx) const
+{
+    if (!idx.isValid()) return Qt::ItemIsDropEnabled;
+    Qt::ItemFlags result = Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemIsDropEnabled;
+    return result | (is_file(idx) ? Qt::ItemNeverHasChildren : Qt::ItemIsDragEnabled);
+}
+
+// Same format as QListWidget uses, so priority list accepts it as new item
+QMimeData* DirTreeModel::mimeData(const QModelIndexList& indexes) const
+{
+    if (indexes.size() != 1 || is_file(indexes[0])) return nullptr;
+    QStringList types = mimeTypes();
+    if (types.isEmpty()) return nullptr;
+
+    QByteArray encoded;
+    QDataStream stream(&encoded, QDataStream::WriteOnly);
+    stream << 0 << 0 << QMap<int, QVariant>{{Qt::DisplayRole, data(indexes[0], Qt::ToolTipRole)}};
+
+    QMimeData* data = new QMimeData();
+    data->setData(types.at(0), encoded);
+    return data;
+}
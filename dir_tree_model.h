@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QAbstractItemModel>
+#include <QIcon>
+
+#include <functional>
+#include <vector>
+
+#include "path_store.h"
+
+// Dup files and their dirs for XDirTree. Nodes live in flat vector and refer to scanner's PathStore, so new file costs one
+// small node (and nodes of its dirs seen first time) - no widget items. Each node counts not hidden files in its subtree,
+// so dirs without visible files are not shown. Children are given to view only when it asks for them (fetchMore) - rows
+// exist only for expanded part of tree, and only these rows are updated when files are added or hidden.
+class DirTreeModel : public QAbstractItemModel {
+    Q_OBJECT
+
+public:
+    DirTreeModel(const PathStore& paths, QObject* parent = nullptr);
+
+    void set_icons(QIcon dir_icon, std::function<QIcon(PathId)> file_icon) {this->dir_icon = dir_icon; this->file_icon = file_icon;}
+
+    void add_file(PathId file);
+    void set_hidden(PathId file, bool hidden);
+    void set_show_hidden(bool show); // Show hidden files too. Tree is rebuilt (collapsed).
+    void file_changed(PathId file);  // Icon of file must be updated
+
+    PathId path_id(const QModelIndex&) const;
+    bool is_file(const QModelIndex&) const;
+    QModelIndex index_of(PathId file); // Rows of all parents are fetched. Invalid index if file is not shown.
+    QVector<PathId> files_under(const QModelIndex&) const; // All files of subtree, hidden too
+    size_t file_count() const {return files;}
+
+    QModelIndex index(int row, int column, const QModelIndex& parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex&) const override;
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& = QModelIndex()) const override {return 1;}
+    bool hasChildren(const QModelIndex& parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+    QVariant data(const QModelIndex&, int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex&) const override;
+
+    // Dirs are dragged to priority list as full paths. Drop from there just removes item from the list.
+    QMimeData* mimeData(const QModelIndexList&) const override;
+    bool canDropMimeData(const QMimeData*, Qt::DropAction, int, int, const QModelIndex&) const override {return true;}
+    bool dropMimeData(const QMimeData*, Qt::DropAction, int, int, const QModelIndex&) override {return true;}
+    Qt::DropActions supportedDragActions() const override {return Qt::CopyAction;}
+    Qt::DropActions supportedDropActions() const override {return Qt::CopyAction | Qt::MoveAction;}
+
+private:
+    struct Node {
+        PathId path = PathStore::NoPath;
+        quint32 parent = 0;  // Node 0 is invisible root
+        quint32 visible = 0; // Not hidden files in subtree (for file itself 0 or 1)
+        qint32 row = -1;     // Position in parent's rows, -1 if not shown
+        bool is_file = false;
+        bool fetched = false; // Rows of children are given to view
+        std::vector<quint32> children;
+    };
+
+    const PathStore& paths;
+    std::vector<Node> nodes;
+    std::vector<quint32> node_by_path; // Indexed by PathId, 0 - no node
+    QHash<quint32, std::vector<quint32>> rows; // <fetched node> -> <shown children sorted by name>
+    size_t files = 0;
+    bool show_hidden = false;
+
+    QIcon dir_icon;
+    std::function<QIcon(PathId)> file_icon;
+
+    quint32 node_of(PathId id) const {return id < node_by_path.size() ? node_by_path[id] : 0;}
+    quint32 node_of(const QModelIndex& idx) const {return idx.isValid() ? quint32(idx.internalId()) : 0;}
+    QModelIndex node_index(quint32 n) const {return n ? createIndex(nodes[n].row, 0, quintptr(n)) : QModelIndex();}
+    bool shown(quint32 n) const {return show_hidden || nodes[n].visible;}
+
+    std::vector<quint32> shown_children(quint32 n) const; // Sorted by name
+    void renumber(std::vector<quint32>& list, size_t from);
+    void sync(quint32 n); // Insert or remove row of node in fetched parent
+    void unfetch(quint32 n);
+    void update_visible(quint32 n, int delta);
+};
@@ -0,0 +1,373 @@
+#include "stdafx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "fast_hash.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FAST_HASH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define HASH_TARGET(x)
+#else
+#define HASH_TARGET(x) __attribute__((target(x)))
+#endif
+#else
+#define FAST_HASH_X86 0
+#endif
+
+namespace {
+
+constexpr size_t STRIPE_SIZE = FastHash128::STRIPE_SIZE;
+constexpr size_t STRIPES_PER_BLOCK = FastHash128::STRIPES_PER_BLOCK;
+constexpr size_t BLOCK_SIZE = FastHash128::BLOCK_SIZE;
+
+constexpr uint64_t PRIME32_1 = 0x9E3779B1U;
+constexpr uint64_t PRIME32_2 = 0x85EBCA77U;
+constexpr uint64_t PRIME32_3 = 0xC2B2AE3DU;
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+// Secret layout: stripe 's' of block uses keys [s, s+8), then scramble keys and 2 sets of final keys
+constexpr size_t SCRAMBLE_KEY = STRIPES_PER_BLOCK + 8;
+constexpr size_t FINAL_KEY_LO = SCRAMBLE_KEY + 8;
+constexpr size_t FINAL_KEY_HI = FINAL_KEY_LO + 8;
+constexpr size_t SECRET_SIZE = FINAL_KEY_HI + 8;
+
+struct Secret {
+    uint64_t v[SECRET_SIZE];
+};
+
+constexpr Secret make_secret() // splitmix64 sequence
+{
+    Secret result{};
+    uint64_t x = 0x6464757048617368ULL;
+    for (auto& k : result.v)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        k = z ^ (z >> 31);
+    }
+    return result;
+}
+
+alignas(64) constexpr Secret SECRET = make_secret();
+
+inline uint64_t read64(const unsigned char* p)
+{
+    uint64_t result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+}
+
+inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    uint64_t hi;
+    uint64_t lo = _umul128(a, b, &hi);
+    return lo ^ hi;
+#elif defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return uint64_t(r) ^ uint64_t(r >> 64);
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lo = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lo ^ hi;
+#endif
+}
+
+inline uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+inline void accumulate_stripe(uint64_t* acc, const unsigned char* data, const uint64_t* key)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        uint64_t d = read64(data + 8 * i);
+        uint64_t k = d ^ key[i];
+        acc[i ^ 1] += d;
+        acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+    }
+}
+
+void blocks_scalar(uint64_t* acc, const unsigned char* data, size_t nblocks)
+{
+    for (; nblocks--; data += BLOCK_SIZE)
+    {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) accumulate_stripe(acc, data + s * STRIPE_SIZE, SECRET.v + s);
+        for (int i = 0; i < 8; ++i)
+        {
+            uint64_t a = acc[i];
+            a ^= a >> 47;
+            a ^= SECRET.v[SCRAMBLE_KEY + i];
+            acc[i] = a * PRIME32_1;
+        }
+    }
+}
+
+#if FAST_HASH_X86
+
+HASH_TARGET("sse2")
+void blocks_sse2(uint64_t* acc, const unsigned char* data, size_t nblocks)
+{
+    __m128i a[4];
+    for (int i = 0; i < 4; ++i) a[i] = _mm_loadu_si128((const __m128i*)(acc + 2 * i));
+    const __m128i prime = _mm_set1_epi32(int(PRIME32_1));
+
+    for (; nblocks--; data += BLOCK_SIZE)
+    {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s)
+        {
+            const unsigned char* p = data + s * STRIPE_SIZE;
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128i d = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+                __m128i k = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)(SECRET.v + s + 2 * i)));
+                __m128i prod = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+                a[i] = _mm_add_epi64(a[i], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+                a[i] = _mm_add_epi64(a[i], prod);
+            }
+        }
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i v = _mm_xor_si128(a[i], _mm_srli_epi64(a[i], 47));
+            v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i*)(SECRET.v + SCRAMBLE_KEY + 2 * i)));
+            __m128i lo = _mm_mul_epu32(v, prime);
+            __m128i hi = _mm_mul_epu32(_mm_srli_epi64(v, 32), prime);
+            a[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+        }
+    }
+    for (int i = 0; i < 4; ++i) _mm_storeu_si128((__m128i*)(acc + 2 * i), a[i]);
+}
+
+HASH_TARGET("avx2")
+void blocks_avx2(uint64_t* acc, const unsigned char* data, size_t nblocks)
+{
+    __m256i a[2];
+    for (int i = 0; i < 2; ++i) a[i] = _mm256_loadu_si256((const __m256i*)(acc + 4 * i));
+    const __m256i prime = _mm256_set1_epi32(int(PRIME32_1));
+
+    for (; nblocks--; data += BLOCK_SIZE)
+    {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s)
+        {
+            const unsigned char* p = data + s * STRIPE_SIZE;
+            for (int i = 0; i < 2; ++i)
+            {
+                __m256i d = _mm256_loadu_si256((const __m256i*)(p + 32 * i));
+                __m256i k = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i*)(SECRET.v + s + 4 * i)));
+                __m256i prod = _mm256_mul_epu32(k, _mm256_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+                a[i] = _mm256_add_epi64(a[i], _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+                a[i] = _mm256_add_epi64(a[i], prod);
+            }
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            __m256i v = _mm256_xor_si256(a[i], _mm256_srli_epi64(a[i], 47));
+            v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i*)(SECRET.v + SCRAMBLE_KEY + 4 * i)));
+            __m256i lo = _mm256_mul_epu32(v, prime);
+            __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), prime);
+            a[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+        }
+    }
+    for (int i = 0; i < 2; ++i) _mm256_storeu_si256((__m256i*)(acc + 4 * i), a[i]);
+}
+
+// Zero-masking forms with full mask are the same instructions as plain ones. Plain forms pass undefined source to masked
+// builtins, which GCC 12 reports as maybe uninitialized.
+constexpr __mmask8 ALL64 = 0xFF;
+constexpr __mmask16 ALL32 = 0xFFFF;
+
+HASH_TARGET("avx512f")
+void blocks_avx512(uint64_t* acc, const unsigned char* data, size_t nblocks)
+{
+    __m512i a = _mm512_loadu_si512(acc);
+    const __m512i prime = _mm512_set1_epi32(int(PRIME32_1));
+
+    for (; nblocks--; data += BLOCK_SIZE)
+    {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s)
+        {
+            __m512i d = _mm512_loadu_si512(data + s * STRIPE_SIZE);
+            __m512i k = _mm512_xor_si512(d, _mm512_loadu_si512(SECRET.v + s));
+            __m512i prod = _mm512_maskz_mul_epu32(ALL64, k, _mm512_maskz_shuffle_epi32(ALL32, k, (_MM_PERM_ENUM)_MM_SHUFFLE(0, 3, 0, 1)));
+            a = _mm512_add_epi64(a, _mm512_maskz_shuffle_epi32(ALL32, d, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2)));
+            a = _mm512_add_epi64(a, prod);
+        }
+        __m512i v = _mm512_xor_si512(a, _mm512_maskz_srli_epi64(ALL64, a, 47));
+        v = _mm512_xor_si512(v, _mm512_loadu_si512(SECRET.v + SCRAMBLE_KEY));
+        __m512i lo = _mm512_maskz_mul_epu32(ALL64, v, prime);
+        __m512i hi = _mm512_maskz_mul_epu32(ALL64, _mm512_maskz_srli_epi64(ALL64, v, 32), prime);
+        a = _mm512_add_epi64(lo, _mm512_maskz_slli_epi64(ALL64, hi, 32));
+    }
+    _mm512_storeu_si512(acc, a);
+}
+
+#endif
+
+struct Kernel {
+    void (*blocks)(uint64_t*, const unsigned char*, size_t);
+    const char* name;
+};
+
+// Best first, scalar is always last
+std::vector<Kernel> detect_kernels()
+{
+    std::vector<Kernel> result;
+#if FAST_HASH_X86
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    int max_leaf = regs[0];
+    __cpuid(regs, 1);
+    bool avx = (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)); // OSXSAVE and AVX
+    unsigned long long xcr0 = avx ? _xgetbv(0) : 0;
+    bool has_avx2 = false, has_avx512 = false;
+    if (max_leaf >= 7)
+    {
+        __cpuidex(regs, 7, 0);
+        has_avx2 = (regs[1] & (1 << 5)) && (xcr0 & 0x06) == 0x06;
+        has_avx512 = (regs[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6;
+    }
+#else
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    bool has_avx512 = __builtin_cpu_supports("avx512f");
+#endif
+    if (has_avx512) result.push_back({blocks_avx512, "avx512"});
+    if (has_avx2) result.push_back({blocks_avx2, "avx2"});
+    result.push_back({blocks_sse2, "sse2"}); // Always present on x86-64
+#endif
+    result.push_back({blocks_scalar, "scalar"});
+    return result;
+}
+
+const std::vector<Kernel>& kernels()
+{
+    static const std::vector<Kernel> k = detect_kernels();
+    return k;
+}
+
+const Kernel& kernel()
+{
+    // DDUP_HASH_KERNEL environment variable can lower kernel level (for benchmarks and cross checks)
+    static const Kernel& k = [] () -> const Kernel& {
+        const char* env = getenv("DDUP_HASH_KERNEL");
+        for (const auto& c : kernels())
+        {
+            if (!env || !*env || strcmp(env, c.name) == 0) return c;
+        }
+        return kernels().front();
+    }();
+    return k;
+}
+
+}
+
+FastHash128::FastHash128() : blocks(kernel().blocks)
+{
+    reset();
+}
+
+FastHash128::FastHash128(const char* name) : blocks(kernel().blocks)
+{
+    for (const auto& c : kernels())
+    {
+        if (strcmp(name, c.name) == 0) blocks = c.blocks;
+    }
+    reset();
+}
+
+void FastHash128::reset()
+{
+    static constexpr uint64_t init[8] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+    memcpy(acc, init, sizeof(acc));
+    buffered = 0;
+    total_size = 0;
+}
+
+void FastHash128::add(const void* data, size_t size)
+{
+    auto p = (const unsigned char*)data;
+    total_size += size;
+    if (buffered)
+    {
+        size_t n = std::min(size, BLOCK_SIZE - buffered);
+        memcpy(buffer + buffered, p, n);
+        buffered += n;
+        p += n;
+        size -= n;
+        if (buffered < BLOCK_SIZE) return;
+        blocks(acc, buffer, 1);
+        buffered = 0;
+    }
+    if (size_t nblocks = size / BLOCK_SIZE)
+    {
+        blocks(acc, p, nblocks);
+        p += nblocks * BLOCK_SIZE;
+        size -= nblocks * BLOCK_SIZE;
+    }
+    memcpy(buffer, p, size);
+    buffered = size;
+}
+
+void FastHash128::result(unsigned char out[DIGEST_SIZE]) const
+{
+    uint64_t a[8];
+    memcpy(a, acc, sizeof(a));
+
+    // Tail: full stripes and then zero padded last stripe. Total size is mixed in below, so padding is not ambiguous.
+    size_t stripes = buffered / STRIPE_SIZE;
+    for (size_t s = 0; s < stripes; ++s) accumulate_stripe(a, buffer + s * STRIPE_SIZE, SECRET.v + s);
+    if (size_t rest = buffered % STRIPE_SIZE)
+    {
+        unsigned char last[STRIPE_SIZE] = {};
+        memcpy(last, buffer + stripes * STRIPE_SIZE, rest);
+        accumulate_stripe(a, last, SECRET.v + stripes);
+    }
+
+    uint64_t lo = total_size * PRIME64_1;
+    uint64_t hi = ~total_size * PRIME64_2;
+    for (int i = 0; i < 8; i += 2)
+    {
+        lo += mul128_fold64(a[i] ^ SECRET.v[FINAL_KEY_LO + i], a[i + 1] ^ SECRET.v[FINAL_KEY_LO + i + 1]);
+        hi += mul128_fold64(a[i] ^ SECRET.v[FINAL_KEY_HI + i], a[i + 1] ^ SECRET.v[FINAL_KEY_HI + i + 1]);
+    }
+    lo = avalanche(lo);
+    hi = avalanche(hi);
+    for (int i = 0; i < 8; ++i)
+    {
+        out[i] = (unsigned char)(lo >> (8 * i));
+        out[8 + i] = (unsigned char)(hi >> (8 * i));
+    }
+}
+
+const char* FastHash128::kernel_name()
+{
+    return kernel().name;
+}
+
+std::vector<const char*> FastHash128::supported_kernels()
+{
+    std::vector<const char*> result;
+    for (const auto& k : kernels()) result.push_back(k.name);
+    return result;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+// Fast non-cryptographic 128 bit hash (XXH3-like striped multiply-accumulate).
+// Has scalar, SSE2, AVX2 and AVX-512 kernels, the best one is selected at runtime. All kernels produce identical results.
+class FastHash128 {
+public:
+    static constexpr size_t STRIPE_SIZE = 64;
+    static constexpr size_t STRIPES_PER_BLOCK = 16;
+    static constexpr size_t BLOCK_SIZE = STRIPE_SIZE * STRIPES_PER_BLOCK;
+    static constexpr size_t DIGEST_SIZE = 16;
+
+    FastHash128();
+    // Hash with given kernel (one of supported_kernels()) instead of selected one - for cross checks
+    explicit FastHash128(const char* kernel);
+
+    void reset();
+    void add(const void* data, size_t size);
+    void result(unsigned char out[DIGEST_SIZE]) const;
+
+    // Name of kernel selected for this CPU ("avx512", "avx2", "sse2" or "scalar")
+    static const char* kernel_name();
+    // Kernels this CPU can run, best first
+    static std::vector<const char*> supported_kernels();
+
+private:
+    using Blocks = void (*)(uint64_t* acc, const unsigned char* data, size_t nblocks);
+    Blocks blocks;
+    alignas(64) uint64_t acc[8];
+    alignas(64) unsigned char buffer[BLOCK_SIZE];
+    size_t buffered;
+    uint64_t total_size;
+};
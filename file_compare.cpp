@@ -0,0 +1,81 @@
+#include "stdafx.h"
+
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "file_compare.h"
+#include "file_reader.h"
+
+static constexpr qint64 COMPARE_CHUNK = 1 << 20;
+static constexpr int COMPARE_BATCH = 16; // Files read together (including reference). Bounds memory to COMPARE_BATCH * COMPARE_CHUNK.
+
+namespace {
+
+struct AlignedBuffer {
+    static constexpr std::align_val_t ALIGN{4096};
+    char* data;
+
+    explicit AlignedBuffer(size_t size) : data((char*)::operator new[](size, ALIGN)) {}
+    ~AlignedBuffer() {::operator delete[](data, ALIGN);}
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+};
+
+struct Member {
+    int index; // In 'files'
+    FileReader reader;
+    AlignedBuffer buffer{COMPARE_CHUNK};
+    bool active = false;
+};
+
+}
+
+QVector<bool> compare_files(const QStringList& files, qint64 size, qint64* bytes_read)
+{
+    QVector<bool> result(files.size(), false);
+    if (files.isEmpty()) return result;
+
+    qint64 total = 0;
+    bool reference_ok = true;
+    // Reference file is re-read for every batch - it keeps memory bounded for big groups
+    for (int first = 1; first < files.size() && reference_ok; first += COMPARE_BATCH - 1)
+    {
+        int count = std::min<int>(COMPARE_BATCH, files.size() - first + 1);
+        std::vector<std::unique_ptr<Member>> members;
+        for (int i = 0; i < count; ++i)
+        {
+            members.push_back(std::make_unique<Member>());
+            auto& m = *members.back();
+            m.index = i ? first + i - 1 : 0;
+            m.active = m.reader.open(files[m.index]);
+            if (m.active) m.reader.advise_sequential(0, size);
+        }
+        if (!members[0]->active) {reference_ok = false; break;}
+
+        bool any_active = true;
+        for (qint64 offset = 0; offset < size && any_active; offset += COMPARE_CHUNK)
+        {
+            qint64 len = std::min(COMPARE_CHUNK, size - offset);
+            auto& ref = *members[0];
+            if (!ref.reader.read_at(ref.buffer.data, offset, len)) {reference_ok = false; break;}
+            ref.reader.drop_cache(offset, len);
+            total += len;
+            any_active = false;
+            for (int i = 1; i < count; ++i)
+            {
+                auto& m = *members[i];
+                if (!m.active) continue;
+                m.active = m.reader.read_at(m.buffer.data, offset, len) && memcmp(m.buffer.data, ref.buffer.data, len) == 0;
+                m.reader.drop_cache(offset, len);
+                total += len;
+                any_active |= m.active;
+            }
+        }
+        if (!reference_ok) break;
+        for (int i = 1; i < count; ++i) result[members[i]->index] = members[i]->active;
+    }
+    if (reference_ok) result[0] = true; else result.fill(false); // Nothing is known if reference can't be read
+    if (bytes_read) *bytes_read += total;
+    return result;
+}
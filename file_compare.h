@@ -0,0 +1,9 @@
+#pragma once
+
+#include <QStringList>
+#include <QVector>
+
+// Byte-by-byte comparison of files of equal size. Files are read in lockstep - one read per file per chunk, nothing is read twice
+// (except reference file for groups bigger than one batch).
+// Returns for each file: true if its contents are equal to files[0]. Files which can't be read are reported as not equal.
+QVector<bool> compare_files(const QStringList& files, qint64 size, qint64* bytes_read = nullptr);
@@ -0,0 +1,98 @@
+#include "stdafx.h"
+
+#ifndef Q_OS_WIN
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include <memory>
+
+#include "file_reader.h"
+
+char* FileReader::buffer()
+{
+    static thread_local std::unique_ptr<char[]> buf(new char[CHUNK_SIZE]);
+    return buf.get();
+}
+
+#ifdef Q_OS_WIN
+
+bool FileReader::open(QString file_name)
+{
+    close();
+    file.setFileName(file_name);
+    return file.open(QIODeviceBase::ReadOnly | QIODeviceBase::Unbuffered);
+}
+
+void FileReader::close()
+{
+    file.close();
+}
+
+bool FileReader::read_at(char* data, qint64 offset, qint64 length)
+{
+    if (!file.seek(offset)) return false;
+    while (length > 0)
+    {
+        qint64 got = file.read(data, length);
+        if (got <= 0) return false;
+        data += got;
+        length -= got;
+    }
+    return true;
+}
+
+void FileReader::advise_sequential(qint64, qint64) {}
+void FileReader::drop_cache(qint64, qint64) {}
+
+#else
+
+bool FileReader::open(QString file_name)
+{
+    close();
+    QByteArray name = QFile::encodeName(file_name);
+#ifdef O_NOATIME
+    fd = ::open(name.constData(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if (fd < 0 && errno == EPERM) // O_NOATIME allowed only for file owner
+#endif
+    fd = ::open(name.constData(), O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
+}
+
+void FileReader::close()
+{
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+bool FileReader::read_at(char* data, qint64 offset, qint64 length)
+{
+    while (length > 0)
+    {
+        ssize_t got = ::pread(fd, data, length, offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false; // Error or file was truncated
+        data += got;
+        offset += got;
+        length -= got;
+    }
+    return true;
+}
+
+void FileReader::advise_sequential(qint64 offset, qint64 length)
+{
+#ifdef Q_OS_LINUX
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+// Scan reads every byte only once - do not let it evict page cache of other processes
+void FileReader::drop_cache(qint64 offset, qint64 length)
+{
+#ifdef Q_OS_LINUX
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+#endif
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QString>
+#include <QFile>
+
+// Reads file contents for hashing instead of mapping them to memory. All reads go through one reusable buffer per thread,
+// so memory used for hashing doesn't depend on file size and a file truncated during scan gives read error instead of SIGBUS.
+// Ranges up to CHUNK_SIZE are read with one call, longer ones are streamed by chunks and dropped from page cache after use.
+class FileReader {
+public:
+    static constexpr qint64 CHUNK_SIZE = 1 << 20;
+
+    FileReader() = default;
+    ~FileReader() {close();}
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    bool open(QString file_name);
+    void close();
+
+    // Read range and pass it to consumer(const char*, qint64) by parts. Return false on read error or if file is shorter than expected.
+    template<class Consumer>
+    bool read(qint64 offset, qint64 length, Consumer&& consumer)
+    {
+        bool streaming = length > CHUNK_SIZE;
+        if (streaming) advise_sequential(offset, length);
+        char* buf = buffer();
+        while (length > 0)
+        {
+            qint64 part = std::min(length, CHUNK_SIZE);
+            if (!read_at(buf, offset, part)) return false;
+            consumer((const char*)buf, part);
+            if (streaming) drop_cache(offset, part);
+            offset += part;
+            length -= part;
+        }
+        return true;
+    }
+
+    // Low level interface for callers with own buffers
+    bool read_at(char* data, qint64 offset, qint64 length); // Read exactly 'length' bytes
+    void advise_sequential(qint64 offset, qint64 length);
+    void drop_cache(qint64 offset, qint64 length);
+
+private:
+#ifdef Q_OS_WIN
+    QFile file;
+#else
+    int fd = -1;
+#endif
+
+    static char* buffer(); // CHUNK_SIZE bytes, one per thread
+};
@@ -0,0 +1,54 @@
+#include "stdafx.h"
+
+#ifdef Q_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "file_stat.h"
+
+#ifdef Q_OS_WIN
+
+bool get_file_stat(QString file, FileStat& st)
+{
+    HANDLE h = CreateFileW((LPCWSTR)QDir::toNativeSeparators(file).utf16(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    BY_HANDLE_FILE_INFORMATION info;
+    bool ok = GetFileInformationByHandle(h, &info);
+    CloseHandle(h);
+    if (!ok) return false;
+    st.dev = info.dwVolumeSerialNumber;
+    st.ino = (quint64(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    st.size = (qint64(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    st.mtime_ns = ((qint64(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime) * 100;
+    st.nlink = info.nNumberOfLinks;
+    return true;
+}
+
+#else
+
+void fill_file_stat(const struct stat& s, FileStat& st)
+{
+    st.dev = s.st_dev;
+    st.ino = s.st_ino;
+    st.size = s.st_size;
+#ifdef Q_OS_MACOS
+    st.mtime_ns = qint64(s.st_mtimespec.tv_sec) * 1000000000 + s.st_mtimespec.tv_nsec;
+#else
+    st.mtime_ns = qint64(s.st_mtim.tv_sec) * 1000000000 + s.st_mtim.tv_nsec;
+#endif
+    st.nlink = s.st_nlink;
+}
+
+bool get_file_stat(QString file, FileStat& st)
+{
+    struct stat s;
+    if (::stat(QFile::encodeName(file).constData(), &s) != 0) return false;
+    fill_file_stat(s, st);
+    return true;
+}
+
+#endif
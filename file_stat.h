@@ -0,0 +1,19 @@
+#pragma once
+
+#include <QString>
+
+// File identity (device, inode) and change stamp
+struct FileStat {
+    quint64 dev = 0;
+    quint64 ino = 0;
+    qint64 size = 0;
+    qint64 mtime_ns = 0;
+    quint32 nlink = 1;
+};
+
+bool get_file_stat(QString file, FileStat& st);
+
+#ifndef Q_OS_WIN
+struct stat;
+void fill_file_stat(const struct stat& s, FileStat& st);
+#endif
@@ -1,65 +1,126 @@
 #include "stdafx.h"
 
+#include <QtConcurrent>
+
 #include "find.h"
 
+FindDialog::FindDialog(const PathStore& paths, QVector<PathId> files) : paths(paths), files(std::move(files))
+{
+    ui.setupUi(this);
+    results_timer = new QTimer(this);
+    connect(results_timer, &QTimer::timeout, this, &FindDialog::take_found);
+    connect(&search, &QFutureWatcher<void>::finished, this, &FindDialog::search_finished);
+}
+
+QVector<FindDialog::AkaPart> FindDialog::compile_aka(QString aka)
+{
+    QVector<AkaPart> result;
+    QString literal;
+    for (qsizetype i = 0; i < aka.size(); ++i)
+    {
+        if (aka[i] != '$' || i + 1 == aka.size()) {literal += aka[i]; continue;}
+        QChar sym = aka[++i];
+        if (!sym.isNumber()) {literal += sym; continue;}
+        if (!literal.isEmpty()) result << AkaPart{literal};
+        literal.clear();
+        result << AkaPart{{}, sym.digitValue()};
+    }
+    if (!literal.isEmpty()) result << AkaPart{literal};
+    return result;
+}
+
+QString FindDialog::expand_aka(const QVector<AkaPart>& program, const QRegularExpressionMatch& match)
+{
+    QString result;
+    for (const auto& part : program) result += part.group < 0 ? part.text : match.captured(part.group);
+    return result;
+}
+
 void FindDialog::on_btn_find_pressed()
 {
-    WaitCursor wc;
+    stop_search();
+    ui.files->clear();
 
-    std::function<QString(QString)> file_extractor;
-    std::function<bool(QString)> match_functor;
-    QRegularExpressionMatch match;
     QString fname = ui.find_name->text();
     QString aka = ui.aka->text().trimmed();
-
     if (!aka_callback) aka = {};
 
-    switch (ui.find_mode->currentIndex())
-    {
-        case 0: file_extractor = [](QString f) {return f;}; break;
-        case 1: file_extractor = [](QString f) {return QFileInfo(f).path();}; break;
-        default: file_extractor = [](QString f) {return QFileInfo(f).fileName(); }; break;
-    }
-    switch (ui.find_type->currentIndex())
+    int mode = ui.find_mode->currentIndex(); // 0 - full path, 1 - dir, 2 - file name
+    bool exact = ui.find_type->currentIndex() == 0;
+    QRegularExpression re;
+    if (!exact)
     {
-        case 0: match_functor = [this, fname](QString f) {return fname == f;}; break;
-        default: 
-        {
-            QRegularExpression re(fname);
-            if (!re.isValid()) {QMessageBox::critical(NULL, "Error", "Invalid Regular Expression"); return;}
-            match_functor = [this, &match, re](QString f) {match = re.match(f); return match.hasMatch();}; 
-            break;
-        }
+        re.setPattern(fname);
+        if (!re.isValid()) {QMessageBox::critical(NULL, "Error", "Invalid Regular Expression"); return;}
+        re.optimize(); // Compile here, not in first thread which uses it
     }
+    bool use_aka = !aka.isEmpty();
+    auto program = compile_aka(aka);
 
-    for (const auto& f : files)
-    {
-        QString ff = file_extractor(f); // Make if offline because QRegularExpressionMatch car refer to it
-        if (!match_functor(ff)) continue;
-        if (!aka.isEmpty())
+    chunks.clear();
+    for (qsizetype i = 0; i < files.size(); i += CHUNK) chunks << i;
+    cancelled = false;
+    search.setFuture(QtConcurrent::map(chunks, [this, mode, exact, fname, re, use_aka, program](qsizetype first) {
+        std::vector<Found> local;
+        qsizetype last = std::min(first + CHUNK, files.size());
+        for (qsizetype i = first; i < last && !cancelled; ++i)
         {
-            static QRegularExpression dlm("\\$(.)");
-            QString processed_aka;
-            auto iter = dlm.globalMatch(aka);
-            if (!iter.hasNext()) processed_aka = aka; else
+            PathId file = files[i];
+            QString subject;
+            switch (mode)
             {
-                int last_pos = 0;
-                while (iter.hasNext())
-                {
-                    auto m = iter.next();
-                    if (m.capturedStart() > last_pos) processed_aka += aka.mid(last_pos, match.capturedStart() - last_pos);
-                    last_pos = m.capturedEnd();
-                    auto sym = m.captured(1);
-                    if (sym[0].isNumber()) processed_aka += match.captured(sym.toInt()); else processed_aka += sym;
-                }
-                if (last_pos < aka.size()) processed_aka += aka.mid(last_pos);
+                case 0: subject = paths.path(file); break;
+                case 1: subject = paths.path(paths.parent(file)); break;
+                default: subject = paths.name(file); break;
             }
-            if (!aka_callback(f, processed_aka)) continue;
+            QRegularExpressionMatch match;
+            if (exact ? subject != fname : !(match = re.match(subject)).hasMatch()) continue;
+            // AKA which is not in PathStore can't be file of the same hash
+            PathId aka_id = PathStore::NoPath;
+            if (use_aka && (aka_id = paths.find(expand_aka(program, match))) == PathStore::NoPath) continue;
+            local.push_back({file, aka_id, mode == 0 ? subject : paths.path(file)});
         }
-        auto item = new QListWidgetItem(f, ui.files);
+        if (local.empty()) return;
+        QMutexLocker<QMutex> l(&found_mutex);
+        found.insert(found.end(), std::make_move_iterator(local.begin()), std::make_move_iterator(local.end()));
+    }));
+    results_timer->start(ResultsPeriod);
+    setWindowTitle("Find (searching...)");
+    ui.pages->setCurrentIndex(1);
+}
+
+// AKA test needs GUI side data, so it is done here, only for files which have matched
+void FindDialog::take_found()
+{
+    std::vector<Found> batch;
+    {
+        QMutexLocker<QMutex> l(&found_mutex);
+        batch.swap(found);
+    }
+    for (const auto& f : batch)
+    {
+        if (f.aka != PathStore::NoPath && !aka_callback(f.file, f.aka)) continue;
+        auto item = new QListWidgetItem(f.path, ui.files);
         item->setCheckState(Qt::Checked);
     }
-    ui.pages->setCurrentIndex(1);
+}
+
+void FindDialog::search_finished()
+{
+    results_timer->stop();
+    if (cancelled) return;
+    take_found();
+    ui.files->sortItems(); // Chunks finish in any order
+    setWindowTitle(QString("Find (%1 found)").arg(ui.files->count()));
+}
+
+void FindDialog::stop_search()
+{
+    cancelled = true;
+    search.waitForFinished();
+    results_timer->stop();
+    QMutexLocker<QMutex> l(&found_mutex);
+    found.clear();
 }
 
 void FindDialog::on_btn_exec_pressed()
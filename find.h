@@ -3,23 +3,65 @@
 #include "ui_find.h"
 
 #include <QDialog>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QTimer>
 
+#include <atomic>
+#include <vector>
+
+#include "path_store.h"
+
+// Files are matched in pool threads, by chunks of 'files'. Found ones are collected in 'found' and moved to list by timer,
+// so list grows while search goes on. AKA template is compiled once per search.
 class FindDialog : public QDialog {
     Q_OBJECT;
 
     Ui::FindDialog ui;
 
-    std::function<bool(QString, QString)> aka_callback;
+    std::function<bool(PathId, PathId)> aka_callback;
     std::function <void(QStringList, FileNodeMode)> action_callback;
     std::function<void(QString)> file_higlight_callback;
 
-    QStringList files;
+    const PathStore& paths;
+    QVector<PathId> files;
+
+    // AKA template: '$<digit>' is captured group of find pattern, '$<char>' is <char> itself, everything else is literal
+    struct AkaPart {
+        QString text;
+        int group = -1; // Captured group, if not -1 (then text is unused)
+    };
+
+    struct Found {
+        PathId file;
+        PathId aka; // NoPath if there is no AKA test
+        QString path;
+    };
+
+    static constexpr qsizetype CHUNK = 4096; // Files per parallel task
+    static constexpr int ResultsPeriod = 200; // ms
+
+    QVector<qsizetype> chunks; // First file of each task
+    QFutureWatcher<void> search;
+    std::atomic<bool> cancelled = false;
+    QMutex found_mutex;
+    std::vector<Found> found;
+    QTimer* results_timer;
+
+    static QVector<AkaPart> compile_aka(QString aka);
+    static QString expand_aka(const QVector<AkaPart>& program, const QRegularExpressionMatch& match);
+
+    void take_found();
+    void search_finished();
+    void stop_search();
 
 public:
-    FindDialog(const QStringList& files) : files(files) {ui.setupUi(this);}
+    FindDialog(const PathStore& paths, QVector<PathId> files);
+    ~FindDialog() {stop_search();}
 
-    // Callback for AKA testing. Arguments: <full file name>, <aka (also full name)>. Return true if both exists and belong to the same hash
-    void set_aka_test(std::function<bool(QString, QString)> cb) {aka_callback = cb;}
+    // Callback for AKA testing. Arguments: <file>, <aka>. Both exists in PathStore. Return true if both are known files of the same hash.
+    // Called in GUI thread.
+    void set_aka_test(std::function<bool(PathId, PathId)> cb) {aka_callback = cb;}
 
     // Callback function for action. Arguments: list of files (full names), action
     void set_action_callback(std::function <void(QStringList, FileNodeMode)> cb) {action_callback = cb;}
@@ -35,6 +77,6 @@ public slots:
         if (file_higlight_callback) file_higlight_callback(item->text());
     }
 
-    void on_btn_cancel_pressed() {done(0); }
-    void on_btn_close_pressed() {done(0); }
-};
\ No newline at end of file
+    void on_btn_cancel_pressed() {stop_search(); done(0);}
+    void on_btn_close_pressed() {stop_search(); done(0);}
+};
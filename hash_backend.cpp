@@ -0,0 +1,54 @@
+#include "stdafx.h"
+
+#include "hash_backend.h"
+
+static const char* const backend_names[] = {"fast128", "md5", "sha256"};
+
+QString hash_backend_name(HashBackend backend)
+{
+    return backend_names[backend];
+}
+
+bool hash_backend_from_name(QString name, HashBackend& backend)
+{
+    for (int i = 0; i < int(std::size(backend_names)); ++i)
+    {
+        if (name == backend_names[i]) {backend = HashBackend(i); return true;}
+    }
+    return false;
+}
+
+Hasher::Hasher(HashBackend backend) : backend(backend)
+{
+    switch (backend)
+    {
+        case HB_Fast: break;
+        case HB_Md5: crypto = std::make_unique<QCryptographicHash>(QCryptographicHash::Md5); break;
+        case HB_Sha256: crypto = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha256); break;
+    }
+}
+
+void Hasher::add(const void* data, size_t size)
+{
+    if (!crypto) {fast.add(data, size); return;}
+    // QByteArrayView is limited by qsizetype - feed huge buffers by parts
+    auto p = (const char*)data;
+    while (size)
+    {
+        size_t part = std::min<size_t>(size, size_t(1) << 30);
+        crypto->addData(QByteArrayView(p, qsizetype(part)));
+        p += part;
+        size -= part;
+    }
+}
+
+QByteArray Hasher::result() const
+{
+    if (!crypto)
+    {
+        QByteArray result(HASH_DIGEST_SIZE, Qt::Uninitialized);
+        fast.result((unsigned char*)result.data());
+        return result;
+    }
+    return crypto->result().left(HASH_DIGEST_SIZE);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+
+#include <memory>
+
+#include "fast_hash.h"
+
+// Content hash used by scanner. Digests of different backends are never comparable - backend is fixed for scan session
+// and must be stored together with any hash saved outside of it.
+enum HashBackend : uint8_t {
+    HB_Fast,    // FastHash128 - fast non-cryptographic hash (default)
+    HB_Md5,     // Legacy MD5
+    HB_Sha256,  // Paranoid mode - cryptographic hash, truncated to digest size
+};
+
+// All backends produce digest of this size
+static constexpr int HASH_DIGEST_SIZE = 16;
+
+QString hash_backend_name(HashBackend);
+bool hash_backend_from_name(QString name, HashBackend& backend);
+
+class Hasher {
+    HashBackend backend;
+    FastHash128 fast;
+    std::unique_ptr<QCryptographicHash> crypto;
+
+public:
+    explicit Hasher(HashBackend backend);
+
+    void add(const void* data, size_t size);
+    QByteArray result() const;
+};
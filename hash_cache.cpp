@@ -0,0 +1,221 @@
+#include "stdafx.h"
+
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <vector>
+
+#include "hash_cache.h"
+
+static_assert(sizeof(HashCache::Record) == HashCache::KEY_SIZE + HASH_DIGEST_SIZE, "Record must have no padding");
+
+static const char cache_magic[8] = {'D', 'D', 'U', 'P', 'H', 'C', 0, 1};
+
+static bool key_less(const HashCache::Record& a, const HashCache::Record& b)
+{
+    return memcmp(&a, &b, HashCache::KEY_SIZE) < 0;
+}
+
+static QByteArray key_bytes(const HashCache::Record& r)
+{
+    return QByteArray((const char*)&r, HashCache::KEY_SIZE);
+}
+
+QString HashCache::default_path()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/ddup/hash_cache.bin";
+}
+
+HashCache::Record HashCache::make_key(const FileStat& st, HashBackend backend, quint32 stages_id, int step)
+{
+    Record result;
+    memset(&result, 0, sizeof(result));
+    result.dev = st.dev;
+    result.ino = st.ino;
+    result.size = st.size;
+    result.mtime_ns = st.mtime_ns;
+    result.stages_id = stages_id;
+    result.backend = backend;
+    result.step = quint8(step);
+    return result;
+}
+
+bool HashCache::open(QString cache_path)
+{
+    close();
+    path = cache_path;
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    bool need_rewrite = false;
+    if (!load(need_rewrite)) return false;
+    if (need_rewrite) // Broken or partially written file - rewrite it with what is valid
+    {
+        compact();
+        if (!load(need_rewrite)) return false;
+    }
+    append_file.setFileName(path);
+    return append_file.open(QIODeviceBase::WriteOnly | QIODeviceBase::Append | QIODeviceBase::Unbuffered);
+}
+
+bool HashCache::load(bool& need_rewrite)
+{
+    unload();
+    need_rewrite = false;
+    map_file.setFileName(path);
+    if (!map_file.exists()) {need_rewrite = true; return true;}
+    if (!map_file.open(QIODeviceBase::ReadOnly)) return false;
+
+    qint64 file_size = map_file.size();
+    quint64 total = file_size >= qint64(sizeof(Header)) ? (file_size - sizeof(Header)) / sizeof(Record) : 0;
+    mapped = file_size >= qint64(sizeof(Header)) ? map_file.map(0, file_size) : nullptr;
+    Header hdr;
+    if (mapped) memcpy(&hdr, mapped, sizeof(hdr));
+    if (!mapped || memcmp(hdr.magic, cache_magic, sizeof(cache_magic)) != 0 || hdr.sorted_count > total)
+    {
+        unload();
+        need_rewrite = true;
+        return true;
+    }
+    sorted = (const Record*)(mapped + sizeof(Header));
+    sorted_count = hdr.sorted_count;
+    get_file_stat(path, loaded);
+    loaded.size = qint64(sizeof(Header) + total * sizeof(Record));
+    for (quint64 i = sorted_count; i < total; ++i)
+    {
+        tail.insert(key_bytes(sorted[i]), QByteArray((const char*)sorted[i].digest, HASH_DIGEST_SIZE));
+    }
+    need_rewrite = file_size != qint64(sizeof(Header) + total * sizeof(Record));
+    return true;
+}
+
+void HashCache::unload()
+{
+    if (mapped) map_file.unmap(mapped);
+    mapped = nullptr;
+    map_file.close();
+    sorted = nullptr;
+    sorted_count = 0;
+    tail.clear();
+    loaded = FileStat();
+}
+
+void HashCache::close()
+{
+    if (path.isEmpty()) return;
+    append_file.close();
+    unload();
+    path.clear();
+}
+
+void HashCache::compact_if_needed()
+{
+    QWriteLocker l(&map_lock);
+    if (path.isEmpty() || tail.size() <= std::max<qsizetype>(1024, sorted_count / 4)) return;
+    append_file.close();
+    compact();
+    bool need_rewrite;
+    if (!load(need_rewrite)) return; // Cache stays empty and records are not written anymore
+    append_file.open(QIODeviceBase::WriteOnly | QIODeviceBase::Append | QIODeviceBase::Unbuffered);
+}
+
+// Records which are in file now, but not in loaded state: appended by other instances after load, or whole file if
+// other instance has replaced it since
+void HashCache::read_disk_records(std::vector<Record>& records)
+{
+    QFile f(path);
+    if (!f.open(QIODeviceBase::ReadOnly)) return;
+    FileStat st;
+    bool same = mapped && get_file_stat(path, st) && st.dev == loaded.dev && st.ino == loaded.ino && st.size >= loaded.size;
+    if (same) f.seek(loaded.size);
+    else
+    {
+        Header hdr;
+        if (f.read((char*)&hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, cache_magic, sizeof(cache_magic)) != 0) return;
+    }
+    qint64 count = (f.size() - f.pos()) / qint64(sizeof(Record));
+    size_t first = records.size();
+    records.resize(first + count);
+    qint64 got = std::max<qint64>(0, f.read((char*)(records.data() + first), count * qint64(sizeof(Record))));
+    records.resize(first + got / sizeof(Record)); // Partially written record at end is dropped
+}
+
+// Merge sorted block, tail (tail wins) and records written by other instances. For every (dev, ino) keep only records
+// of its latest version.
+void HashCache::compact()
+{
+    QLockFile lock(path + ".lock");
+    if (!lock.tryLock(0)) return; // Other instance compacts it now
+
+    std::vector<Record> records;
+    read_disk_records(records);
+    records.reserve(records.size() + sorted_count + tail.size());
+    for (quint64 i = 0; i < sorted_count; ++i)
+    {
+        if (!tail.contains(key_bytes(sorted[i]))) records.push_back(sorted[i]);
+    }
+    for (const auto& [key, digest] : tail.asKeyValueRange())
+    {
+        Record r;
+        memcpy(&r, key.constData(), KEY_SIZE);
+        memcpy(r.digest, digest.constData(), HASH_DIGEST_SIZE);
+        records.push_back(r);
+    }
+    std::sort(records.begin(), records.end(), key_less);
+
+    std::vector<Record> result;
+    result.reserve(records.size());
+    for (size_t first = 0; first < records.size();)
+    {
+        size_t last = first;
+        qint64 latest = records[first].mtime_ns;
+        while (last < records.size() && records[last].dev == records[first].dev && records[last].ino == records[first].ino)
+        {
+            latest = std::max(latest, records[last].mtime_ns);
+            ++last;
+        }
+        for (size_t i = first; i < last; ++i)
+        {
+            if (records[i].mtime_ns != latest) continue;
+            if (!result.empty() && !key_less(result.back(), records[i])) continue; // Same key from file and from tail
+            result.push_back(records[i]);
+        }
+        first = last;
+    }
+
+    unload(); // Mapped file is going to be replaced
+    QSaveFile f(path);
+    if (!f.open(QIODeviceBase::WriteOnly)) return;
+    Header hdr;
+    memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+    hdr.sorted_count = result.size();
+    f.write((const char*)&hdr, sizeof(hdr));
+    f.write((const char*)result.data(), qint64(result.size() * sizeof(Record)));
+    f.commit();
+}
+
+bool HashCache::lookup(const Record& key, QByteArray& digest)
+{
+    QReadLocker rl(&map_lock);
+    auto iter = std::lower_bound(sorted, sorted + sorted_count, key, key_less);
+    bool in_sorted = iter != sorted + sorted_count && !key_less(key, *iter);
+
+    QMutexLocker<QMutex> l(&mutex);
+    auto t = tail.constFind(key_bytes(key));
+    if (t != tail.constEnd()) {digest = t.value(); return true;}
+    if (!in_sorted) return false;
+    digest = QByteArray((const char*)iter->digest, HASH_DIGEST_SIZE);
+    return true;
+}
+
+void HashCache::insert(const Record& key, QByteArray digest)
+{
+    Record r = key;
+    memcpy(r.digest, digest.constData(), HASH_DIGEST_SIZE);
+
+    QReadLocker rl(&map_lock);
+    QMutexLocker<QMutex> l(&mutex);
+    tail.insert(key_bytes(r), digest);
+    if (append_file.isOpen()) append_file.write((const char*)&r, sizeof(r)); // Whole record in one write
+}
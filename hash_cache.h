@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QString>
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "file_stat.h"
+#include "hash_backend.h"
+
+// Persistent cache of hash step keys, keyed by file identity and change stamp.
+// File layout: header, sorted block of records (binary searched directly in mapped file), then records appended by
+// later sessions (loaded to memory on open). Compaction merges them into new sorted block and drops outdated records.
+// Records are appended by one unbuffered write each, so several instances appending at once don't mix partial records.
+// Compaction is done by one instance at a time (lock file). It re-reads records other instances appended since file
+// was loaded (or whole file, if other instance replaced it by its compaction); only records appended while it runs are lost.
+class HashCache {
+public:
+    struct Record {
+        quint64 dev;
+        quint64 ino;
+        qint64 size;
+        qint64 mtime_ns;
+        quint32 stages_id; // Fingerprint of hash stages chain
+        quint8 backend;
+        quint8 step;
+        quint16 reserved;
+        unsigned char digest[HASH_DIGEST_SIZE];
+    };
+    static constexpr size_t KEY_SIZE = offsetof(Record, digest);
+
+    HashCache() = default;
+    ~HashCache() {close();}
+    HashCache(const HashCache&) = delete;
+    HashCache& operator=(const HashCache&) = delete;
+
+    bool open(QString path);
+    void close();
+    // Compact file if it has many appended records. Slow on big cache - not for GUI thread. Lookups wait until it is done.
+    void compact_if_needed();
+
+    static Record make_key(const FileStat&, HashBackend, quint32 stages_id, int step);
+    bool lookup(const Record& key, QByteArray& digest);
+    void insert(const Record& key, QByteArray digest);
+
+    static QString default_path();
+
+private:
+    struct Header {
+        char magic[8];
+        quint64 sorted_count;
+    };
+
+    QReadWriteLock map_lock; // Written only by compaction, which replaces mapped file
+    QMutex mutex; // Guards 'tail' and 'append_file'. Sorted block is read only.
+    QString path;
+    QFile map_file;
+    uchar* mapped = nullptr;
+    const Record* sorted = nullptr;
+    quint64 sorted_count = 0;
+    QHash<QByteArray, QByteArray> tail; // <key bytes> -> <digest>
+    QFile append_file;
+    FileStat loaded; // File as it was loaded (size - of whole records only)
+
+    bool load(bool& need_rewrite);
+    void read_disk_records(std::vector<Record>& records);
+    void unload();
+    void compact();
+};
@@ -0,0 +1,178 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "hash_stages.h"
+
+QVector<HashStage> default_hash_stages()
+{
+    return {
+        {HS_Head, START_SCAN_SIZE},
+        {HS_Tail, START_SCAN_SIZE},
+        {HS_Samples, START_SCAN_SIZE, 4},
+        {HS_Head, 1 << 20},
+        {HS_Head, 16 << 20},
+        {HS_Head, 256 << 20},
+        {HS_Full}
+    };
+}
+
+bool parse_size(QString text, qint64& size)
+{
+    static const QString suffixes = "kmg";
+    qint64 mult = 1;
+    text = text.trimmed().toLower();
+    if (!text.isEmpty() && suffixes.contains(text.back()))
+    {
+        for (int i = suffixes.indexOf(text.back()); i >= 0; --i) mult *= 1024;
+        text.chop(1);
+    }
+    bool ok;
+    qint64 value = text.toLongLong(&ok);
+    if (!ok || value <= 0 || value > std::numeric_limits<qint64>::max() / mult) return false;
+    size = value * mult;
+    return true;
+}
+
+static QString size_to_string(qint64 size)
+{
+    static const char* const suffixes[] = {"", "k", "m", "g"};
+    int idx = 0;
+    while (idx < 3 && size % 1024 == 0) {size /= 1024; ++idx;}
+    return QString::number(size) + suffixes[idx];
+}
+
+bool parse_hash_stages(QString text, QVector<HashStage>& stages)
+{
+    QVector<HashStage> result;
+    for (const auto& item : text.split(",", Qt::SkipEmptyParts))
+    {
+        auto parts = item.trimmed().split(":");
+        QString kind = parts[0].toLower();
+        HashStage st{HS_Full};
+        if (kind == "full") {if (parts.size() != 1) return false;} else
+        {
+            if (parts.size() != 2) return false;
+            if (kind == "head" || kind == "chunk") st.kind = HS_Head; else
+            if (kind == "tail") st.kind = HS_Tail; else
+            if (kind == "samples")
+            {
+                st.kind = HS_Samples;
+                auto sp = parts[1].split("x");
+                if (sp.size() != 2) return false;
+                bool ok;
+                st.samples = sp[0].toInt(&ok);
+                if (!ok || st.samples <= 0) return false;
+                parts[1] = sp[1];
+            }
+            else return false;
+            if (!parse_size(parts[1], st.length)) return false;
+            if (st.kind == HS_Samples && st.length > std::numeric_limits<qint64>::max() / 2 / st.samples) return false;
+        }
+        result << st;
+    }
+    stages = result;
+    return true;
+}
+
+QString hash_stages_to_string(const QVector<HashStage>& stages)
+{
+    QStringList result;
+    for (const auto& st : stages)
+    {
+        switch (st.kind)
+        {
+            case HS_Head: result << "head:" + size_to_string(st.length); break;
+            case HS_Tail: result << "tail:" + size_to_string(st.length); break;
+            case HS_Samples: result << QString("samples:%1x%2").arg(st.samples).arg(size_to_string(st.length)); break;
+            case HS_Full: result << "full"; break;
+        }
+    }
+    return result.join(",");
+}
+
+// Sampled blocks lie between hashed head and tail. Later steps skip them, so no byte is hashed twice.
+QVector<HashStep> plan_hash_steps(const QVector<HashStage>& stages, qint64 size)
+{
+    QVector<HashStep> result;
+    qint64 prefix = 0; // Bytes already hashed at start of file
+    qint64 suffix = 0; // ... and at end of file
+    QVector<QPair<qint64, qint64>> sampled; // <begin, end> of hashed blocks in the middle. Sorted, not overlapping.
+
+    // Add range [begin, end) without sampled blocks to step
+    auto add_range = [&sampled](HashStep& step, qint64 begin, qint64 end) {
+        for (const auto& [sb, se] : sampled)
+        {
+            if (se <= begin || sb >= end) continue;
+            if (sb > begin) step.ranges << qMakePair(begin, sb - begin);
+            begin = se;
+        }
+        if (begin < end) step.ranges << qMakePair(begin, end - begin);
+    };
+
+    for (int idx = 0; idx < stages.size() && prefix + suffix < size; ++idx)
+    {
+        const auto& st = stages[idx];
+        qint64 gap = size - prefix - suffix;
+        HashStep step{idx};
+        switch (st.kind)
+        {
+            case HS_Head:
+            {
+                if (st.length <= prefix) continue;
+                qint64 len = std::min(st.length - prefix, gap);
+                add_range(step, prefix, prefix + len);
+                prefix += len;
+                break;
+            }
+            case HS_Tail:
+            {
+                if (st.length <= suffix) continue;
+                qint64 len = std::min(st.length - suffix, gap);
+                add_range(step, size - suffix - len, size - suffix);
+                suffix += len;
+                break;
+            }
+            case HS_Samples:
+            {
+                if (gap <= 2 * st.samples * st.length) continue; // Too small - next stage will hash all of it anyway
+                for (int i = 0; i < st.samples; ++i)
+                {
+                    qint64 offset = prefix + gap * (i + 1) / (st.samples + 1) - st.length / 2;
+                    qint64 begin = std::max(prefix, offset & ~qint64(4095));
+                    qint64 end = std::min(begin + st.length, size - suffix);
+                    add_range(step, begin, end);
+                    sampled << qMakePair(begin, end);
+                    std::sort(sampled.begin(), sampled.end());
+                    // Merge overlapping blocks
+                    qsizetype out = 0;
+                    for (qsizetype k = 1; k < sampled.size(); ++k)
+                    {
+                        if (sampled[k].first <= sampled[out].second) sampled[out].second = std::max(sampled[out].second, sampled[k].second);
+                        else sampled[++out] = sampled[k];
+                    }
+                    sampled.resize(out + 1);
+                }
+                break;
+            }
+            case HS_Full:
+            {
+                add_range(step, prefix, size - suffix);
+                prefix += gap;
+                break;
+            }
+        }
+        step.complete = prefix + suffix >= size;
+        if (step.ranges.isEmpty() && !step.complete) continue; // All of it was sampled already
+        result << step;
+    }
+    if (result.isEmpty() || !result.back().complete)
+    {
+        HashStep step{int(stages.size())};
+        add_range(step, prefix, size - suffix);
+        step.complete = true;
+        result << step;
+    }
+    return result;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QVector>
+#include <QPair>
+#include <QString>
+
+// Size for initial Scan of file
+static constexpr qint64 START_SCAN_SIZE = 4*1024;
+
+// Changed when plan_hash_steps gives other ranges for the same stages - keys cached by older plan are not used
+static constexpr int HASH_PLAN_VERSION = 1;
+
+enum HashStageKind {
+    HS_Head,    // Hash file up to 'length' (hashed part only grows - used for head and growing chunks)
+    HS_Tail,    // Hash last 'length' bytes of file
+    HS_Samples, // Hash 'samples' blocks of 'length' bytes evenly spread over not yet hashed middle of file
+    HS_Full     // Hash rest of file
+};
+
+// One stage of progressive hashing. File moves to next stage only while its group at current stage has more than one member.
+struct HashStage {
+    HashStageKind kind;
+    qint64 length = 0;
+    int samples = 0;
+};
+
+// Stage applied to file of some size
+struct HashStep {
+    int stage; // Index in stage list (equal to list size for implicit Full stage)
+    QVector<QPair<qint64, qint64>> ranges; // <offset, length> to hash
+    bool complete = false; // All file contents hashed after this step
+};
+
+QVector<HashStage> default_hash_stages();
+
+// Parse stage list like "head:4k,tail:4k,samples:4x4k,chunk:1m,full"
+bool parse_hash_stages(QString text, QVector<HashStage>& stages);
+QString hash_stages_to_string(const QVector<HashStage>&);
+
+// Parse positive size with optional k/m/g suffix (like "4k")
+bool parse_size(QString text, qint64& size);
+
+// Steps for file of given size. Each byte is hashed by exactly one step (sampled blocks are skipped by later head, tail
+// and full stages). Stages which add nothing for this size are skipped, last step is always complete.
+// Depends only on file size, so all files in one group go through the same steps.
+QVector<HashStep> plan_hash_steps(const QVector<HashStage>&, qint64 size);
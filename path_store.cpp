@@ -0,0 +1,193 @@
+#include "stdafx.h"
+
+#include "path_store.h"
+
+PathStore::PathStore()
+{
+    entries.emplace_back(new Entry[ENTRY_CHUNK]);
+    entries[0][0] = Entry{NoPath, 0, 0};
+    table.resize(1024);
+}
+
+// Root component keeps its slash ("/", "//" or "C:/"), so joining components with '/' gives original path
+QStringList PathStore::split(QString path)
+{
+    qsizetype root_size = path.startsWith("//") ? 2 : path.indexOf('/') + 1;
+    if (!root_size) root_size = path.size();
+    QStringList result(path.left(root_size));
+    result << path.mid(root_size).split('/', Qt::SkipEmptyParts);
+    return result;
+}
+
+size_t PathStore::hash(PathId parent, const QByteArray& name)
+{
+    return qHashBits(name.constData(), name.size(), parent) * 0x9E3779B97F4A7C15ull;
+}
+
+PathId PathStore::lookup(PathId parent, const QByteArray& name, size_t h) const
+{
+    size_t mask = table.size() - 1;
+    for (size_t idx = h & mask;; idx = (idx + 1) & mask)
+    {
+        PathId id = table[idx];
+        if (id == NoPath) return NoPath;
+        const Entry& e = entry(id);
+        if (e.parent == parent && e.name_size == name.size() && memcmp(name_data(e), name.constData(), name.size()) == 0) return id;
+    }
+}
+
+void PathStore::rehash(size_t new_size)
+{
+    table.assign(new_size, NoPath);
+    size_t mask = new_size - 1;
+    for (PathId id = 1; id < count; ++id)
+    {
+        const Entry& e = entry(id);
+        size_t idx = hash(e.parent, QByteArray::fromRawData(name_data(e), e.name_size)) & mask;
+        while (table[idx] != NoPath) idx = (idx + 1) & mask;
+        table[idx] = id;
+    }
+}
+
+PathId PathStore::insert(PathId parent, const QByteArray& name, size_t h)
+{
+    if (count == std::numeric_limits<PathId>::max()) return NoPath;
+    if (quint64(count) * 2 >= table.size()) rehash(table.size() * 2);
+    if (arena_used + name.size() > ARENA_CHUNK)
+    {
+        if (arena.size() >= std::numeric_limits<quint32>::max() / ARENA_CHUNK) return NoPath; // 4G of names
+        arena.emplace_back(new char[ARENA_CHUNK]);
+        arena_used = 0;
+    }
+    quint32 offset = quint32(arena.size() - 1) * ARENA_CHUNK + arena_used;
+    memcpy(arena.back().get() + arena_used, name.constData(), name.size());
+    arena_used += quint32(name.size());
+
+    PathId id = count++;
+    if ((id >> ENTRY_CHUNK_BITS) == entries.size()) entries.emplace_back(new Entry[ENTRY_CHUNK]);
+    entries[id >> ENTRY_CHUNK_BITS][id & (ENTRY_CHUNK - 1)] = Entry{parent, offset, quint16(name.size())};
+
+    size_t mask = table.size() - 1;
+    size_t idx = h & mask;
+    while (table[idx] != NoPath) idx = (idx + 1) & mask;
+    table[idx] = id;
+    return id;
+}
+
+PathId PathStore::intern_utf8(PathId parent, const QByteArray& name)
+{
+    size_t h = hash(parent, name);
+    {
+        QReadLocker l(&lock);
+        if (PathId id = lookup(parent, name, h)) return id;
+    }
+    QWriteLocker l(&lock);
+    if (PathId id = lookup(parent, name, h)) return id;
+    return insert(parent, name, h);
+}
+
+PathId PathStore::intern(PathId parent, QString name)
+{
+    return intern_utf8(parent, name.toUtf8().left(std::numeric_limits<quint16>::max()));
+}
+
+PathId PathStore::intern(QString path)
+{
+    PathId id = NoPath;
+    for (const auto& part : split(path))
+    {
+        id = intern(id, part);
+        if (id == NoPath) break; // Store is full - NoPath parent would make next part a root
+    }
+    return id;
+}
+
+PathId PathStore::find(QString path) const
+{
+    PathId id = NoPath;
+    QReadLocker l(&lock);
+    for (const auto& part : split(path))
+    {
+        QByteArray name = part.toUtf8();
+        id = lookup(id, name, hash(id, name));
+        if (id == NoPath) break;
+    }
+    return id;
+}
+
+QString PathStore::path(PathId id) const
+{
+    QReadLocker l(&lock);
+    if (id == NoPath || id >= count) return {};
+    std::vector<const Entry*> parts;
+    qsizetype size = 0;
+    for (; id != NoPath; id = entry(id).parent)
+    {
+        parts.push_back(&entry(id));
+        size += parts.back()->name_size + 1;
+    }
+    QByteArray result;
+    result.reserve(size);
+    for (auto iter = parts.rbegin(); iter != parts.rend(); ++iter)
+    {
+        if (!result.isEmpty() && !result.endsWith('/')) result += '/';
+        result.append(name_data(**iter), (*iter)->name_size);
+    }
+    return QString::fromUtf8(result);
+}
+
+QString PathStore::name(PathId id) const
+{
+    QReadLocker l(&lock);
+    if (id == NoPath || id >= count) return {};
+    const Entry& e = entry(id);
+    return QString::fromUtf8(name_data(e), e.name_size);
+}
+
+PathId PathStore::parent(PathId id) const
+{
+    QReadLocker l(&lock);
+    return id < count ? entry(id).parent : NoPath;
+}
+
+size_t PathStore::size() const
+{
+    QReadLocker l(&lock);
+    return count;
+}
+
+void PathStore::save(QDataStream& out) const
+{
+    QReadLocker l(&lock);
+    out << count;
+    for (PathId id = 1; id < count; ++id)
+    {
+        const Entry& e = entry(id);
+        out << e.parent << QByteArray::fromRawData(name_data(e), e.name_size);
+    }
+}
+
+bool PathStore::load(QDataStream& in)
+{
+    if (size() != 1) return false;
+    quint32 total = 0;
+    in >> total;
+    for (PathId id = 1; id < total; ++id)
+    {
+        PathId parent = NoPath;
+        QByteArray name;
+        in >> parent >> name;
+        if (in.status() != QDataStream::Ok || parent >= id || intern_utf8(parent, name) != id) return false;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+void PathStore::clear()
+{
+    QWriteLocker l(&lock);
+    entries.resize(1);
+    arena.clear();
+    arena_used = ARENA_CHUNK;
+    count = 1;
+    table.assign(1024, NoPath);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QDataStream>
+#include <QReadWriteLock>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+using PathId = quint32;
+
+// Interned paths shared by scanner and UI. Each path is stored once as <parent id, name>, names are packed as UTF-8 into
+// arena chunks, so 32 bit id replaces full path string in all stores. Full path is rebuilt on demand (for display and syscalls).
+// Thread safe. Ids are dense and never freed.
+class PathStore {
+public:
+    static constexpr PathId NoPath = 0; // Also parent of root components ("/" or "C:/")
+
+    PathStore();
+    PathStore(const PathStore&) = delete;
+    PathStore& operator=(const PathStore&) = delete;
+
+    // Both return NoPath if store is full (4G ids or 4G bytes of names)
+    PathId intern(QString path);                // Absolute path (with '/' separators)
+    PathId intern(PathId parent, QString name); // Entry of already interned dir
+    PathId find(QString path) const;            // NoPath if path was never interned
+
+    QString path(PathId) const;
+    QString name(PathId) const;
+    PathId parent(PathId) const;
+    size_t size() const; // Number of ids (max id + 1)
+
+    // Checkpoint support. Store can be loaded only when empty - ids are restored as they were.
+    void save(QDataStream&) const;
+    bool load(QDataStream&);
+    void clear(); // Drop all paths. Only while no ids are in use.
+
+private:
+    static constexpr int ENTRY_CHUNK_BITS = 16;
+    static constexpr quint32 ENTRY_CHUNK = 1 << ENTRY_CHUNK_BITS;
+    static constexpr quint32 ARENA_CHUNK = 1 << 20;
+
+    struct Entry {
+        PathId parent;
+        quint32 name_offset; // Offset in arena (chunk * ARENA_CHUNK + position)
+        quint16 name_size;
+    };
+
+    mutable QReadWriteLock lock;
+    std::vector<std::unique_ptr<Entry[]>> entries; // Chunks of ENTRY_CHUNK entries, entry 0 is NoPath
+    quint32 count = 1;
+    std::vector<std::unique_ptr<char[]>> arena;
+    quint32 arena_used = ARENA_CHUNK; // Position in last arena chunk
+    std::vector<PathId> table; // Open addressing <parent, name> -> id, 0 - free slot
+
+    const Entry& entry(PathId id) const {return entries[id >> ENTRY_CHUNK_BITS][id & (ENTRY_CHUNK - 1)];}
+    const char* name_data(const Entry& e) const {return arena[e.name_offset / ARENA_CHUNK].get() + e.name_offset % ARENA_CHUNK;}
+    static size_t hash(PathId parent, const QByteArray& name);
+    PathId lookup(PathId parent, const QByteArray& name, size_t h) const;
+    PathId insert(PathId parent, const QByteArray& name, size_t h);
+    PathId intern_utf8(PathId parent, const QByteArray& name);
+    void rehash(size_t new_size);
+
+    static QStringList split(QString path);
+};
@@ -17,19 +17,42 @@ QDupFind::QDupFind(QWidget *parent)
 {
     ui.setupUi(this);
 
-    connect(ui.actionPause, &QAction::enabledChanged, [this](bool enabled) {if (enabled) dir_node_flush(true);});
-
     ui.dirs->set_buddy(ui.prio);
 
     ui.errors_box->hide();
+
+    auto hash_group = new QActionGroup(this);
+    hash_group->addAction(ui.actionHash_fast);
+    hash_group->addAction(ui.actionHash_md5);
+    hash_group->addAction(ui.actionHash_sha256);
+    ui.actionHash_fast->setText(QString("Fast (%1)").arg(FastHash128::kernel_name()));
+    auto age_group = new QActionGroup(this); // Oldest and newest contradict each other
+    age_group->setExclusionPolicy(QActionGroup::ExclusionPolicy::ExclusiveOptional);
+    age_group->addAction(ui.actionRule_oldest);
+    age_group->addAction(ui.actionRule_newest);
 //    ui.files_box->hide();
 
     scanner = new ScanThread(this);
+    scanner->set_verify(ui.actionVerify->isChecked());
+    on_actionSerial_HDD_triggered(ui.actionSerial_HDD->isChecked());
+    on_actionHash_cache_triggered(ui.actionHash_cache->isChecked());
+    scanner->set_checkpoint(ScanThread::default_checkpoint_path());
+
+    dir_model = new DirTreeModel(scanner->get_paths(), this);
+    dir_model->set_icons(style()->standardIcon(QStyle::SP_DirIcon), [this](PathId file) {
+        auto iter = all_files.constFind(file);
+        return get_icon((iter == all_files.cend() ? FNM_None : iter->file_mode) | FNM_AddFileIcon);
+    });
+    ui.dirs->setModel(dir_model);
+    connect(ui.dirs->selectionModel(), &QItemSelectionModel::currentChanged, this, &QDupFind::dirs_current_changed);
 
-    connect(scanner, &ScanThread::new_dir, this, &QDupFind::scan_new_dir, Qt::BlockingQueuedConnection);
-    connect(scanner, &ScanThread::new_dup, this, &QDupFind::scan_new_dup, Qt::QueuedConnection);
+    // Results are pulled from scanner on our own cadence - scanner never waits for UI
+    auto results_timer = new QTimer(this);
+    connect(results_timer, &QTimer::timeout, this, &QDupFind::scan_take_results);
+    results_timer->start(ResultsPeriod);
     connect(scanner, &ScanThread::stat_update, this, &QDupFind::scan_stat_update, Qt::QueuedConnection);
     connect(scanner, &ScanThread::error, this, &QDupFind::scan_error, Qt::QueuedConnection);
+    connect(scanner, &ScanThread::suspended, this, [this]() {ui.actionPause->setDisabled(false);});
 
 //    new QShortcut(Qt::Key_Space, ui.files, [this]() {on_btn_invert_pressed();}, Qt::WidgetShortcut);
 //    new QShortcut(Qt::Key_Delete, ui.files, [this]() {on_btn_remove_pressed();}, Qt::WidgetShortcut);
@@ -39,6 +62,12 @@ QDupFind::QDupFind(QWidget *parent)
     progress_bar->hide();
     statusBar()->addPermanentWidget(progress_bar);
 
+    deleter = new DeleteExecutor(scanner->get_paths(), this);
+    delete_timer = new QTimer(this);
+    connect(delete_timer, &QTimer::timeout, this, &QDupFind::delete_take_done);
+    connect(deleter, &DeleteExecutor::finished, this, &QDupFind::delete_finished);
+    connect(deleter, &DeleteExecutor::error, this, &QDupFind::add_error, Qt::QueuedConnection);
+
     dir_queue_pending = new QLabel("   ");
     dir_queue_pending->setFrameShape(QFrame::Panel);
     dir_queue_pending->setFrameShadow(QFrame::Sunken);
@@ -56,7 +85,12 @@ QDupFind::QDupFind(QWidget *parent)
 
 QDupFind::~QDupFind()
 {
-    scanner->terminate();
+    delete deleter; // Paths it uses are owned by scanner
+    // Scanner saves checkpoint after dirs in work are finished. If it takes too long, it is cancelled (previous checkpoint
+    // file stays). Scanner is not terminated - it may hold mutexes workers wait for.
+    scanner->exit_with_checkpoint();
+    if (!scanner->wait(ExitTimeout)) scanner->cancel_checkpoint();
+    scanner->wait();
 }
 
 QIcon QDupFind::get_icon(FileNodeModes mode)
@@ -112,13 +146,31 @@ void QDupFind::scan_stat_update(ScanState event)
 {
     if (!start_of_scan.isValid()) start_of_scan = QTime::currentTime();
 
-    dir_node_flush(event.dirs_to_proceed <= 1);
-
     QString msg = QString("File dups: %1/%3").arg(event.total_dups).arg(event.total_files);
     if (event.total_false_dups) msg += QString(" | False dups: %1").arg(event.total_false_dups);
-    msg += QString(" | Dirs: %1/%2").arg(event.total_dirs - event.dirs_to_proceed).arg(event.total_dirs);
+    if (event.cached_hashes) msg += QString(" | Cached: %1").arg(event.cached_hashes);
+    if (event.total_hardlinks) msg += QString(" | Hardlinks: %1").arg(event.total_hardlinks);
+    double secs = std::max<qint64>(1, event.elapsed_ms) / 1000.0;
+    if (event.verified_files)
+    {
+        // Rate of comparison itself - verification runs only for part of scan time
+        double verify_secs = std::max<qint64>(1, event.verify_ns) / 1e9;
+        msg += QString(" | Verified: %1 (%2 MB/s)").arg(event.verified_files).arg(event.verified_bytes / verify_secs / (1 << 20), 0, 'f', 1);
+    }
+    if (event.bytes_read)
+    {
+        msg += QString(" | Read: %1 MB/s | Hashed: %2 MB/s").arg(event.bytes_read / secs / (1 << 20), 0, 'f', 1)
+            .arg(event.bytes_hashed / secs / (1 << 20), 0, 'f', 1);
+    }
+    size_t dirs_done = event.total_dirs - event.dirs_to_proceed;
+    msg += QString(" | Dirs: %1/%2").arg(dirs_done).arg(event.total_dirs);
+    if (dirs_done && event.dirs_to_proceed) // Rough - assumes remaining dirs are like scanned ones
+    {
+        qint64 eta = qint64(double(event.elapsed_ms) * event.dirs_to_proceed / dirs_done / 1000);
+        msg += " | ETA: " + QTime(0,0,0).addSecs(eta).toString("h:mm:ss");
+    }
 
-    dir_queue_pending->setText(QString("%1").arg(dir_tree_added_items, 3));
+    dir_queue_pending->setText(QString("%1").arg(dir_model->file_count(), 3));
 
     QTime diff = QTime(0,0,0).addSecs(start_of_scan.secsTo(QTime::currentTime()));
 
@@ -137,135 +189,97 @@ void QDupFind::scan_stat_update(ScanState event)
 void QDupFind::on_actionAdd_directory_triggered(bool)
 {
     QString dir = QFileDialog::getExistingDirectory(this, "Select directory to scan");
-    if (!dir.isEmpty()) scanner->scan_dir(dir);
+    if (dir.isEmpty()) return;
+    scanner->scan_dir(dir);
+    ui.menuHash->setEnabled(false); // Hashes of different backends can't be mixed in one scan
+    ui.actionResume_scan->setEnabled(false);
 }
 
-/*
-static QTreeWidgetItem* find_in_children(QTreeWidgetItem* root, QString text)
+void QDupFind::on_actionResume_scan_triggered(bool)
 {
-    for (int i = 0; i < root->childCount(); ++i)
+    if (!scanner->resume(ScanThread::default_checkpoint_path()))
     {
-        auto child = root->child(i);
-        if (child->text(0) == text) return child;
+        add_error("Can't resume scan from '" + ScanThread::default_checkpoint_path() + "'");
+        return;
     }
-    return NULL;
+    // Settings of resumed scan
+    ui.actionVerify->setChecked(scanner->get_verify());
+    ui.actionHash_fast->setChecked(scanner->get_hash_backend() == HB_Fast);
+    ui.actionHash_md5->setChecked(scanner->get_hash_backend() == HB_Md5);
+    ui.actionHash_sha256->setChecked(scanner->get_hash_backend() == HB_Sha256);
+    ui.menuHash->setEnabled(false);
+    ui.actionResume_scan->setEnabled(false);
 }
-*/
 
-QTreeWidgetItem* QDupFind::add_dir_node_to_cache(QString path)
+void QDupFind::on_actionHash_cache_triggered(bool checked)
 {
-    auto path_list = path.split("/", Qt::SkipEmptyParts);
-    DirTreeNode* root = &dir_tree_cache;
-    for (const auto& ent : path_list)
+    if (!scanner->set_hash_cache(checked ? HashCache::default_path() : QString()))
     {
-        auto iter = root->children.find(ent);
-        if (iter == root->children.end()) iter = root->children.insert(ent, {});
-        iter->follow_children = true;
-        root = &iter.value();
+        add_error("Can't open hash cache '" + HashCache::default_path() + "'");
+        ui.actionHash_cache->setChecked(false);
     }
-    if (!root->item)
-    {
-        root->item = new QTreeWidgetItem(QStringList(path_list.last()));
-        root->pending_insert = true;
-        ++dir_tree_added_items;
-    }
-    root->is_dir = false;
-    return root->item;
 }
 
-void QDupFind::dir_node_flush(bool force)
+void QDupFind::select_hash_backend(HashBackend backend)
 {
-    if (!force && dir_tree_added_items < DirTreeMaxItems && dir_tree_last_update.msecsTo(QTime::currentTime()) < DirTreeMaxTimeout) return;
-    if (dir_tree_added_items)
-    {
-        dir_node_flush(dir_tree_cache, ui.dirs->invisibleRootItem());
-        dir_tree_added_items = 0;
-        dir_tree_last_update = QTime::currentTime();
-        dir_queue_pending->setText(" [Pending: 0]");
-    }
+    if (!scanner->set_hash_backend(backend)) add_error("Hash can't be changed after scan started");
 }
 
-void QDupFind::dir_node_flush(DirTreeNode& root, QTreeWidgetItem* root_item)
+void QDupFind::scan_take_results()
 {
-    int idx = 0;
-
-    for (auto iter = root.children.begin(); iter != root.children.end(); ++iter)
+    PathId dir = scanner->get_current_dir();
+    if (dir != shown_dir)
     {
-        auto name = iter.key();
-        auto& ent = iter.value();
-        if (ent.pending_insert)
-        {
-            if (!ent.item) ent.item = new QTreeWidgetItem(QStringList(name));
-            ent.item->setIcon(0, style()->standardIcon(ent.is_dir ? QStyle::SP_DirIcon : QStyle::SP_FileIcon));
-            root_item->insertChild(idx, ent.item);
-            ent.pending_insert = false;
-        }        
-        if (ent.follow_children) 
-        {
-            ent.item->setHidden(false);
-            dir_node_flush(ent, ent.item); 
-            ent.follow_children = false;
-        }
-        ++idx;
+        shown_dir = dir;
+        ui.dir_to_process->setText(file_path(dir));
     }
-}
-
-QTreeWidgetItem* QDupFind::add_dir(QString path)
-{
-    auto result = add_dir_node_to_cache(path);
-    dir_node_flush();
-    return result;
-}
 
-void QDupFind::scan_new_dup(QString fname, QByteArray hash)
-{
-   auto wg = add_dir(fname);
+    scanner->take_results(new_results);
+    if (new_results.empty()) return;
 
-   auto ptr = all_files.insert(fname, FileInfo{
-        .hash = hash,
-        .file_mode = FNM_None,
-        .item = wg
-   });
-   files_by_hash.insert(hash, ptr);
+    files_by_hash.reserve(files_by_hash.size() + qsizetype(new_results.size()));
+    for (const auto& res : new_results)
+    {
+        if (all_files.contains(res.file)) continue;
+        auto ptr = all_files.insert(res.file, FileInfo{
+            .hash = res.hash,
+            .file_mode = FNM_None
+        });
+        files_by_hash.insert(res.hash, ptr);
+        auto& g = groups[res.hash];
+        ++g.files;
+        ++g.unassigned;
+        dir_model->add_file(res.file);
+    }
 }
 
-void QDupFind::set_file_mode(QString fname, FileNodeModes mode)
+void QDupFind::set_file_mode(PathId file, FileNodeModes mode)
 {
-    dir_node_flush(true);
     switch(mode)
     {
-        case FNM_KeepMe: keep_me(fname); return;
-        case FNM_KeepOther: keep_other(fname); return;
+        case FNM_KeepMe: keep_me(file); return;
+        case FNM_KeepOther: keep_other(file); return;
     }
-    assert(all_files.contains(fname));
-    auto& ent = all_files[fname];
+    assert(all_files.contains(file));
+    auto& ent = all_files[file];
 
     if (ent.file_mode & FNM_Hide) return;
 
-    auto total = classify(ent.hash, {FNM_Delete | FNM_KeepDup}, fname);
-
     if (mode & FNM_DeleteManual && !ui.actionEnable_full_delete->isChecked()) // Verify that we do not delete all alternatives
     {
-        if (total[2] + 1 == total[0]) return; // We delete all (Intended Dups not taken in account) - reject
+        const auto& g = groups[ent.hash];
+        int others = g.delete_or_dup - ((ent.file_mode & (FNM_Delete | FNM_KeepDup)) ? 1 : 0);
+        if (others + 1 == g.files) return; // We delete all (Intended Dups not taken in account) - reject
     }
 
-    ent.file_mode = mode;
-    ent.item->setIcon(0, get_icon(ent.file_mode | FNM_AddFileIcon));
-
-    int idx=0;
-    while(auto wg = ui.files->item(idx++))
-    {
-        if (wg->text() == fname)
-        {
-            wg->setIcon(get_icon(ent.file_mode));
-            break;
-        }
-    }
+    change_mode(ent, mode);
+    dir_model->file_changed(file);
+    if (auto wg = file_items.value(file)) wg->setIcon(get_icon(ent.file_mode));
 
     if (ui.actionAuto_complete->isChecked() && mode & (FNM_DeleteManual | FNM_KeepManual | FNM_KeepDup))
     {
-        auto total = classify(ent.hash, {FNM_Delete | FNM_KeepDup});
-        if (total[1] == 1 && total[2] + 1 == total[0]) // We delete (or make intended Dup) all but 1 unassigned entry - make it Keep
+        const auto& g = groups[ent.hash];
+        if (g.unassigned == 1 && g.delete_or_dup + 1 == g.files) // We delete (or make intended Dup) all but 1 unassigned entry - make it Keep
         {
             auto range = files_by_hash.equal_range(ent.hash);
             for (auto iter = range.first; iter != range.second; ++iter)
@@ -280,58 +294,20 @@ void QDupFind::set_file_mode(QString fname, FileNodeModes mode)
     }
 }
 
-void QDupFind::hide_file(QString fname)
-{
-    dir_node_flush(true);
-
-    assert(all_files.contains(fname));
-    auto& ent = all_files[fname];
-
-    ent.file_mode |= FNM_Hide;
-    if (ui.actionShow_processed_entries->isChecked()) return;
-
-    hide_dir_item(ent.item);
-}
-
-void QDupFind::hide_dir_item(QTreeWidgetItem* root)
-{
-    root->setHidden(true);
-    root = root->parent();
-    for (;root; root = root->parent())
-    {
-        for(int ch_idx=0; ch_idx < root->childCount(); ++ch_idx)
-        {
-            if (!root->child(ch_idx)->isHidden()) return;
-        }
-        root->setHidden(true);
-    }
-}
-
-void QDupFind::hide_dir_tree()
+void QDupFind::hide_file(PathId file)
 {
-    dir_node_flush(true);
-
-    for(const auto& ent: all_files)
-    {
-        if (ent.file_mode & FNM_Hide) hide_dir_item(ent.item);
-    }
+    assert(all_files.contains(file));
+    auto& ent = all_files[file];
+    change_mode(ent, ent.file_mode | FNM_Hide);
+    dir_model->set_hidden(file, true);
 }
 
-void QDupFind::show_dir_tree()
+void QDupFind::show_file(PathId file)
 {
-    dir_node_flush(true);
-
-    for (const auto& ent : all_files)
-    {
-        if (ent.file_mode & FNM_Hide)
-        {
-            for(auto root = ent.item; root; root=root->parent())
-            {
-                if (!root->isHidden()) break;
-                root->setHidden(false);
-            }
-        }
-    }
+    QModelIndex idx = dir_model->index_of(file);
+    if (!idx.isValid()) return;
+    ui.dirs->setCurrentIndex(idx);
+    ui.dirs->scrollTo(idx);
 }
 
 void QDupFind::set_file_mode_all(QByteArray hash, FileNodeModes new_mode)
@@ -343,56 +319,54 @@ void QDupFind::set_file_mode_all(QByteArray hash, FileNodeModes new_mode)
     }
 }
 
-QString QDupFind::get_current_file_name()
+PathId QDupFind::get_current_file()
 {
-    dir_node_flush(true);
-
-    QString file;
-    if (ui.dirs->hasFocus()) file = tree_item_to_path(ui.dirs->currentItem()); else
+    PathId file;
+    if (ui.dirs->hasFocus()) file = dir_model->path_id(ui.dirs->currentIndex()); else
     if (ui.files->hasFocus()) 
     {
-        if (auto p = ui.files->currentItem()) file = p->text(); else
-        if (auto p = ui.files->selectedItems(); !p.isEmpty()) file = p[0]->text();
-        else return {};
+        if (auto p = ui.files->currentItem()) file = p->data(Qt::UserRole).toUInt(); else
+        if (auto p = ui.files->selectedItems(); !p.isEmpty()) file = p[0]->data(Qt::UserRole).toUInt();
+        else return PathStore::NoPath;
     }
-    else return {};
-    if (!all_files.contains(file)) return {};
+    else return PathStore::NoPath;
+    if (!all_files.contains(file)) return PathStore::NoPath;
     return file;
 }
 
 void QDupFind::set_current_file_mode(FileNodeModes new_mode)
 {
-    QString file = get_current_file_name();
-    if (!file.isEmpty()) set_file_mode(file, new_mode);
+    PathId file = get_current_file();
+    if (file != PathStore::NoPath) set_file_mode(file, new_mode);
 }
 
-void QDupFind::keep_me(QString file)
+void QDupFind::keep_me(PathId file)
 {
-    if (file.isEmpty()) return;
+    if (file == PathStore::NoPath) return;
     set_file_mode(file, FNM_KeepManual);
     set_file_mode_all(all_files[file].hash, FNM_DeleteManual);
 }
 
-void QDupFind::keep_other(QString file)
+void QDupFind::keep_other(PathId file)
 {
-    if (file.isEmpty()) return;
+    if (file == PathStore::NoPath) return;
     set_file_mode(file, FNM_DeleteManual);
 
     auto range = files_by_hash.equal_range(all_files[file].hash);
-    QString fname;
+    PathId other = PathStore::NoPath;
     int count = 0;
 
     for (auto iter = range.first; iter != range.second && count < 2; ++iter)
     {
-        if (!iter.value()->file_mode) {fname = iter.value().key(); ++count;}
+        if (!iter.value()->file_mode) {other = iter.value().key(); ++count;}
     }
-    if (count == 1) set_file_mode(fname, FNM_KeepManual);
+    if (count == 1) set_file_mode(other, FNM_KeepManual);
 }
 
 void QDupFind::on_actionInvert_triggered(bool)
 {
-    QString file = get_current_file_name();
-    if (file.isEmpty()) return;
+    PathId file = get_current_file();
+    if (file == PathStore::NoPath) return;
     auto file_mode = all_files[file].file_mode;
     
     if (file_mode & FNM_Hide) return;
@@ -406,33 +380,35 @@ void QDupFind::on_actionInvert_triggered(bool)
 
 void QDupFind::on_actionKeep_as_intended_duplicate_triggered(bool)
 {
-    QString file = get_current_file_name();
-    if (!file.isEmpty()) {set_file_mode(file, FNM_KeepDup); return;}
+    PathId file = get_current_file();
+    if (file != PathStore::NoPath) {set_file_mode(file, FNM_KeepDup); return;}
     if (!ui.dirs->hasFocus()) return;
-    set_file_mode_rec(ui.dirs->currentItem(), FNM_KeepDup);
+    set_file_mode_rec(ui.dirs->currentIndex(), FNM_KeepDup);
 }
 
-void QDupFind::set_file_mode_rec(QTreeWidgetItem* root, FileNodeModes mode)
+void QDupFind::set_file_mode_rec(const QModelIndex& root, FileNodeModes mode)
 {
-    QString file = tree_item_to_path(root);
-    if (all_files.contains(file)) { set_file_mode(file, mode); return; }
-    for(int idx=0; idx<root->childCount(); ++idx)
+    if (!root.isValid()) return;
+    for (auto file : dir_model->files_under(root))
     {
-        set_file_mode_rec(root->child(idx), mode);
+        if (all_files.contains(file)) set_file_mode(file, mode);
     }
 }
 
-void QDupFind::on_dirs_currentItemChanged(QTreeWidgetItem* current, QTreeWidgetItem*)
+void QDupFind::clear_files()
 {
-    QSignalBlocker b(ui.dirs);
-    QSignalBlocker b2(ui.files);
+    file_items.clear();
+    ui.files->clear();
+}
 
-    dir_node_flush(true);
+void QDupFind::dirs_current_changed(const QModelIndex& current)
+{
+    QSignalBlocker b(ui.dirs->selectionModel());
+    QSignalBlocker b2(ui.files);
 
-    ui.files->clear();
-    if (!current || current->isHidden()) return;
-    auto path = tree_item_to_path(current);
-    auto org_ptr = all_files.find(path);
+    clear_files();
+    if (!current.isValid()) return;
+    auto org_ptr = all_files.find(dir_model->path_id(current));
     if (org_ptr == all_files.end()) return;
     auto range = files_by_hash.equal_range(org_ptr->hash);
     for (auto iter = range.first; iter != range.second; ++iter)
@@ -443,173 +419,198 @@ void QDupFind::on_dirs_currentItemChanged(QTreeWidgetItem* current, QTreeWidgetI
             if (file_mode & FNM_Hide) continue;
         }
         auto icon = get_icon(file_mode);
-        auto wg = new QListWidgetItem(icon, iter->key(), ui.files);
+        auto wg = new QListWidgetItem(icon, file_path(iter->key()), ui.files);
+        wg->setData(Qt::UserRole, iter->key());
+        file_items.insert(iter->key(), wg);
         if (*iter == org_ptr) wg->setSelected(true);
     }
 }
 
 void QDupFind::on_files_currentItemChanged(QListWidgetItem* current, QListWidgetItem* previous)
 {
-    QSignalBlocker b(ui.dirs);
+    QSignalBlocker b(ui.dirs->selectionModel());
     QSignalBlocker b2(ui.files);
 
     if (!current) return;
 
-    dir_node_flush(true);
+    PathId file = current->data(Qt::UserRole).toUInt();
+    if (!all_files.contains(file)) return;
+    show_file(file);
+}
 
-    auto path = current->text();
-    if (!all_files.contains(path)) return;
-    ui.dirs->setCurrentItem(all_files[path].item);
+// Files are hidden as they are deleted - view is refreshed only at the end
+void QDupFind::delete_take_done()
+{
+    deleter->take_done(deleted);
+    for (auto file : deleted)
+    {
+        hide_file(file);
+        scanner->remove_file(file, all_files[file].hash);
+    }
+    progress_bar->setMaximum(int(deleter->get_total()));
+    progress_bar->setValue(int(deleter->get_processed()));
 }
 
-bool QDupFind::do_delete(QString fname)
+void QDupFind::delete_finished()
 {
-#if DEL_DRYRUN
-    add_error("Delete " + fname);
-#else
-    if (!QDir().remove(fname)) return false;
-    auto dir = QFileInfo(fname).absoluteDir();
-    if (dir.isEmpty()) return dir.rmpath(".");
-#endif
-    return true;
+    delete_timer->stop();
+    delete_take_done();
+    progress_bar->hide();
+    ui.actionRun->setEnabled(true);
+    ui.actionCancel_run->setEnabled(false);
+    clear_files();
+    dirs_current_changed(ui.dirs->currentIndex());
+}
+
+// File explicitly kept is preferred, otherwise any file which is not marked for delete
+PathId QDupFind::share_source(QByteArray hash)
+{
+    PathId source = PathStore::NoPath;
+    auto range = files_by_hash.equal_range(hash);
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        auto mode = iter.value()->file_mode;
+        if (mode & FNM_Delete) continue;
+        if (!source || (mode & (FNM_Keep | FNM_KeepDup))) source = iter.value().key();
+        if (mode & (FNM_Keep | FNM_KeepDup)) break;
+    }
+    return source;
 }
 
 void QDupFind::on_actionRun_triggered(bool)
 {
     WaitCursor wc;
 
-    dir_node_flush(true);
+    if (deleter->is_running()) return;
 
-    for (const auto& [file_name, ent] : all_files.asKeyValueRange())
+    // Plan is snapshotted here - marks changed while it is executed are not taken in account
+    bool share = ui.actionShare_blocks->isChecked();
+    QMap<QByteArray, QVector<PathId>> to_share; // <hash> -> files marked for delete
+    std::vector<PathId> to_delete;
+    for (const auto& [file, ent] : all_files.asKeyValueRange())
     {
         if (ent.file_mode & FNM_Hide) continue;
         if (ent.file_mode & (FNM_Keep | FNM_KeepDup))
         {
-            if (is_all_assigned(ent.hash)) hide_file(file_name); 
+            if (is_all_assigned(ent.hash)) hide_file(file);
         }
-        else if ((ent.file_mode & FNM_Delete) && do_delete(file_name))
+        else if (ent.file_mode & FNM_Delete)
         {
-            hide_file(file_name);
-            scanner->remove_file(file_name, ent.hash);
+            if (share) to_share[ent.hash] << file;
+            else to_delete.push_back(file);
         }
     }
-    ui.files->clear();
-    on_dirs_currentItemChanged(ui.dirs->currentItem(), NULL);
+    std::vector<DeleteExecutor::ShareGroup> share_groups;
+    size_t share_files = 0;
+    for (const auto& [hash, files] : to_share.asKeyValueRange())
+    {
+        PathId source = share_source(hash);
+        if (!source) {add_error("No file to share blocks with for " + file_path(files.front())); continue;}
+        share_groups.push_back({source, files});
+        share_files += files.size();
+    }
+
+#if DEL_DRYRUN
+    for (auto file : to_delete)
+    {
+        add_error("Delete " + file_path(file));
+        hide_file(file);
+    }
+    to_delete.clear();
+    for (const auto& g : share_groups)
+    {
+        for (auto file : g.files) add_error("Share " + file_path(file) + " with " + file_path(g.source));
+    }
+    share_groups.clear();
+    share_files = 0;
+#endif
+    if (to_delete.empty() && share_groups.empty())
+    {
+        clear_files();
+        dirs_current_changed(ui.dirs->currentIndex());
+        return;
+    }
+    ui.actionRun->setEnabled(false);
+    ui.actionCancel_run->setEnabled(true);
+    progress_bar->setMaximum(int(to_delete.size() + share_files));
+    progress_bar->setValue(0);
+    progress_bar->show();
+    deleter->start(std::move(to_delete), std::move(share_groups));
+    delete_timer->start(ResultsPeriod);
 }
 
 void QDupFind::on_actionShow_processed_entries_triggered(bool show)
 {
-    dir_node_flush(true);
-
-    if (show) show_dir_tree();
-    else hide_dir_tree();
-    ui.files->clear();
-    on_dirs_currentItemChanged(ui.dirs->currentItem(), NULL);
+    PathId current = dir_model->path_id(ui.dirs->currentIndex());
+    dir_model->set_show_hidden(show);
+    show_file(current);
+    clear_files();
+    dirs_current_changed(ui.dirs->currentIndex());
 }
 //////////////////////
 
-void PrioDirTree::add_dir(DirNode& root, const QStringList& path, int index, int priority)
-{
-    auto ptr = root.children.find(path[index]);
-    if (ptr == root.children.end()) ptr = root.children.insert(path[index], {});
-    if (index + 1 < path.size()) add_dir(ptr.value(), path, index+1, priority);
-    else ptr->priority = priority;
-}
-
-int PrioDirTree::get_dir(DirNode& root, const QStringList& path, int index, int parent_priority)
-{
-    auto ptr = root.children.find(path[index]);
-    if (ptr == root.children.end()) return parent_priority;
-    if (ptr->priority != NoPrio) parent_priority = ptr->priority;
-    if (index + 1 >= path.size()) return parent_priority;
-    return get_dir(ptr.value(), path, index+1, parent_priority);
-}
-///////////////////////
-
 void QDupFind::on_actionAuto_by_Dirs_triggered(bool)
 {
     WaitCursor wc;
-    PrioDirTree prio;
+    AutoPolicy policy(scanner->get_paths());
 
     int cur_prio = ui.prio->count();
     for (int i = 0; i < ui.prio->count(); ++i)
     {
         QString text = ui.prio->item(i)->text();
         if (text == "<default>") {cur_prio = -1; continue;}
-        prio.add_dir(text, cur_prio--);
-    }
-    if (prio.empty() || files_by_hash.empty()) {sb_message("AutoDir: No priorities or files - nothing to process"); return;}
-
-    QByteArray cur_hash = files_by_hash.begin().key();
-    for (;;)
-    {
-        auto range = files_by_hash.equal_range(cur_hash);
-        if (range.first == range.second) break;
-        process_prio_range(prio, range.first, range.second);
-        if (range.second == files_by_hash.end()) break;
-        cur_hash = range.second.key();
+        policy.add_dir(text, cur_prio--);
     }
-    sb_message(QString("AutoDir: Processed %1 file(s) in %2 bundles").arg(prio.total_files).arg(prio.total_hashes));
-}
-
-void QDupFind::process_prio_range(PrioDirTree& prio_tree, HashPtr begin, HashPtr end)
-{
-    int max_keep_priority = std::numeric_limits<int>::min();
-    QMultiMap<int, FilePtr> prio_list;
-
-    for (auto iter = begin; iter != end; ++iter)
+    // Tie breakers in order of menu
+    if (ui.actionRule_fastest->isChecked()) policy.add_rule(AutoPolicy::AR_FastestDevice);
+    if (ui.actionRule_oldest->isChecked()) policy.add_rule(AutoPolicy::AR_Oldest);
+    if (ui.actionRule_newest->isChecked()) policy.add_rule(AutoPolicy::AR_Newest);
+    if (ui.actionRule_shortest->isChecked()) policy.add_rule(AutoPolicy::AR_ShortestPath);
+    if (policy.empty() || files_by_hash.empty()) {sb_message("AutoDir: No priorities, rules or files - nothing to process"); return;}
+
+    // Snapshot of groups with undecided files. Files of one hash are neighbours in files_by_hash.
+    std::vector<AutoPolicy::Member> members;
+    std::vector<FilePtr> member_files;
+    std::vector<size_t> begins{0};
+    QByteArray group_hash;
+    bool undecided = false;
+    auto close_group = [&]() {
+        if (undecided) begins.push_back(members.size());
+        members.resize(begins.back());
+        member_files.resize(begins.back());
+        undecided = false;
+    };
+    for (auto iter = files_by_hash.cbegin(); iter != files_by_hash.cend(); ++iter)
     {
-        const auto ptr = iter.value();
-        if (ptr->file_mode & FNM_KeepManual)
-        {
-            max_keep_priority = std::max(max_keep_priority, prio_tree.get_dir(iter.value().key()));
-        }
-        if (ptr->file_mode & (FNM_KeepManual|FNM_KeepDup|FNM_DeleteManual|FNM_Hide)) continue;
-        int prio = prio_tree.get_dir(iter.value().key());
-        prio_list.insert(prio, ptr);
+        if (iter.key() != group_hash) {close_group(); group_hash = iter.key();}
+        auto mode = iter.value()->file_mode;
+        bool kept = bool(mode & FNM_KeepManual);
+        if (!kept && (mode & (FNM_KeepDup | FNM_DeleteManual | FNM_Hide))) continue;
+        members.push_back({iter.value().key(), kept});
+        member_files.push_back(iter.value());
+        undecided |= !kept;
     }
+    close_group();
 
-    if (prio_list.isEmpty()) return;
-    int active_prio = prio_list.lastKey();
-    int total_last_prio = prio_list.count(active_prio);
-
-    ++prio_tree.total_hashes;
-
-    enum Action {
-        Keep = FNM_KeepAuto,
-        Discard = FNM_DeleteAuto,
-        Terminate = 10000,
-    } action;
-
-    if (max_keep_priority == active_prio) action = Discard; else // If we have at least one already 'Keep' file at maximum priority - use it and discard all other
-    if (total_last_prio == 1) action = Keep; // If we have exactly one file at maximum priority - keep it
-    else action = Terminate; // More than one - let's user decide (just stop processing)
-
-    for (const auto& e : prio_list.asKeyValueRange())
+    // Decisions are applied as one batch - they can't trigger auto complete or delete guard
+    auto decisions = policy.evaluate(members, begins);
+    size_t decided = 0;
+    for (size_t i = 0; i < members.size(); ++i)
     {
-        if (e.first < active_prio) 
-        {
-            set_file_mode(e.second.key(), FNM_DeleteAuto); 
+        if (decisions[i] == AutoPolicy::PD_None) continue;
+        change_mode(*member_files[i], decisions[i] == AutoPolicy::PD_Keep ? FNM_KeepAuto : FNM_DeleteAuto);
+        dir_model->file_changed(members[i].file);
 #if AUT_VERBOSE
-            add_error(QString("File %1 deleted").arg(e.second.key()));
+        add_error(QString("File %1 %2").arg(file_path(members[i].file)).arg(decisions[i] == AutoPolicy::PD_Keep ? "saved" : "deleted"));
 #endif
-        }
-        else if (action == Terminate) break;
-        else 
-        {
-            set_file_mode(e.second.key(), FileNodeMode(action)); 
-#if AUT_VERBOSE
-            add_error(QString("File %1 %2").arg(e.second.key()).arg(action == Keep ? "saved" : "deleted"));
-#endif
-        }
-        ++prio_tree.total_files;
+        ++decided;
     }
+    dirs_current_changed(ui.dirs->currentIndex());
+    sb_message(QString("AutoDir: Processed %1 file(s) in %2 bundles").arg(decided).arg(begins.size() - 1));
 }
 
 void QDupFind::on_actionScan_for_Empty_dirs_triggered(bool)
 {
-    dir_node_flush(true);
-
     EmptyDirsDialog dlg;
 
     dlg.fill(scanner);
@@ -622,23 +623,50 @@ void QDupFind::on_actionScan_for_Empty_dirs_triggered(bool)
     }
 }
 
-void QDupFind::on_actionProcess_by_mask_triggered(bool)
+// Hardlink groups found so far: first seen link on top, other links of the same inode below it
+void QDupFind::on_actionShow_hardlinks_triggered(bool)
 {
-    dir_node_flush(true);
+    QDialog dlg(this);
+    dlg.setWindowTitle("Hardlinks");
+    dlg.resize(700, 400);
+    auto tree = new QTreeWidget(&dlg);
+    tree->setHeaderHidden(true);
+    auto buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dlg);
+    connect(buttons, &QDialogButtonBox::rejected, &dlg, &QDialog::reject);
+    auto layout = new QVBoxLayout(&dlg);
+    layout->addWidget(tree);
+    layout->addWidget(buttons);
+
+    {
+        WaitCursor wc;
+        auto links = scanner->get_hardlinks();
+        for (const auto& [primary, others] : links.asKeyValueRange())
+        {
+            auto item = new QTreeWidgetItem(tree, QStringList(primary));
+            for (const auto& link : others) new QTreeWidgetItem(item, QStringList(link));
+        }
+    }
+    if (!tree->topLevelItemCount()) new QTreeWidgetItem(tree, QStringList("No hardlinks found"));
+    dlg.exec();
+}
 
-    FindDialog dlg(all_files.keys());
+void QDupFind::on_actionProcess_by_mask_triggered(bool)
+{
+    FindDialog dlg(scanner->get_paths(), all_files.keys());
 
-    dlg.set_aka_test([this](QString file_name, QString aka_name) {
-        if (!all_files.contains(file_name) || !all_files.contains(aka_name)) return false;
-        return all_files[file_name].hash == all_files[aka_name].hash;
+    dlg.set_aka_test([this](PathId f, PathId a) {
+        auto file = all_files.find(f), aka = all_files.find(a);
+        if (file == all_files.end() || aka == all_files.end()) return false;
+        return file->hash == aka->hash;
     });
 
     dlg.set_action_callback([this](QStringList files, FileNodeMode mode) {
-        for(auto f: files) set_file_mode(f, mode);
+        for(auto f: files) set_file_mode(file_id(f), mode);
     });
 
     dlg.set_file_higlight_callback([this](QString path) {
-        if (all_files.contains(path)) ui.dirs->setCurrentItem(all_files[path].item);
+        PathId file = file_id(path);
+        if (all_files.contains(file)) show_file(file);
     });
 
     dlg.exec();
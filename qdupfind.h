@@ -6,130 +6,98 @@
 #include "ui_qdupfind.h"
 
 #include "scan_thread.h"
+#include "auto_policy.h"
+#include "delete_executor.h"
+#include "dir_tree_model.h"
 
 // Information about one File
 struct FileInfo {
     QByteArray hash;
     FileNodeModes file_mode{ FNM_None };
-    QTreeWidgetItem* item = NULL; // File entry in DirTree
 };
 
-using FilesMap = QMap<QString, FileInfo>; // <full file name> -> <file-info>
+using FilesMap = QMap<PathId, FileInfo>; // <file id in scanner PathStore> -> <file-info>
 using FilePtr = FilesMap::iterator; // Pointer to FilesMap
 
-class PrioDirTree {
-    static constexpr const int NoPrio = std::numeric_limits<int>::max();
-
-    struct DirNode {
-        int priority = NoPrio;
-        QMap<QString, DirNode> children;
-    };
-    DirNode root;
-
-    void add_dir(DirNode& root, const QStringList& path, int index, int priority);
-    int get_dir(DirNode& root, const QStringList& path, int index, int parent_priority);
-
-public:
-    void add_dir(QString path, int priority) {add_dir(root, path.split("/", Qt::SkipEmptyParts), 0, priority); }
-    int get_dir(QString path) {return get_dir(root, path.split("/", Qt::SkipEmptyParts), 0, 0); }
-
-    bool empty() const {return root.children.isEmpty(); }
-
-    // Just put them here. This class do not use it, but outside code use as temporary storage
-    int total_hashes = 0;
-    int total_files = 0;
-};
-
-
 class QDupFind : public QMainWindow
 {
     Q_OBJECT
 
     ScanThread* scanner;
+    DirTreeModel* dir_model; // Content of ui.dirs
     QProgressBar* progress_bar;
     QLabel* dir_queue_pending;
     QLabel* time;
 
 
-    FilesMap all_files; // <file name> -> <file info>
+    FilesMap all_files; // <file id> -> <file info>
     QMultiHash<QByteArray, FilePtr> files_by_hash; // <hash> -> <pointer to file in all_files>
-    using HashPtr = QMultiHash<QByteArray, FilePtr>::iterator;
 
     QHash<FileNodeModes, QIcon> icons;
 
     QTime start_of_scan;
 
-    // We use dir_tree_cache to hold delayed update info for ui.dirs
-    // This structure will not used for navigation
-    struct DirTreeNode {
-        QTreeWidgetItem* item = NULL;
-        bool is_dir = true;
-        bool pending_insert = true;
-        bool follow_children = true;
-        QMap<QString, DirTreeNode> children;
+    static const int ResultsPeriod = 100; // How often (in ms) new dups are taken from scanner
+    static const int ExitTimeout = 10000; // How long (in ms) to wait for scanner checkpoint on exit
+    std::vector<ScanThread::DupResult> new_results; // Buffer swapped with scanner's one
+    PathId shown_dir = PathStore::NoPath;
+
+    DeleteExecutor* deleter;
+    QTimer* delete_timer; // Pulls deleted files while plan is executed
+    std::vector<PathId> deleted; // Buffer swapped with deleter's one
+
+    // Counters of hash group members by mode, updated on each mode change (see change_mode), so group questions don't
+    // need walk over members
+    struct GroupState {
+        int files = 0;
+        int unassigned = 0;    // FNM_None
+        int delete_or_dup = 0; // FNM_Delete or FNM_KeepDup (hidden too)
     };
-    DirTreeNode dir_tree_cache;
-    QTime dir_tree_last_update = QTime::currentTime();
-    size_t dir_tree_added_items = 0;
-
-    static const int DirTreeMaxItems = 1000; // How many items can be queied
-    static const int DirTreeMaxTimeout = 500; // How long (in ms) dir tree update can be held
+    QHash<QByteArray, GroupState> groups;
 
-    QTreeWidgetItem* add_dir_node_to_cache(QString);
-    void dir_node_flush(bool force = false);
-    void dir_node_flush(DirTreeNode&, QTreeWidgetItem* root_item);
-
-    QVector<int> classify(QByteArray hash, std::initializer_list<FileNodeModes> filter, QString ignore = {})
+    static void count_mode(GroupState& g, FileNodeModes mode, int delta)
+    {
+        if (!mode) g.unassigned += delta;
+        if (mode & (FNM_Delete | FNM_KeepDup)) g.delete_or_dup += delta;
+    }
+    void change_mode(FileInfo& ent, FileNodeModes mode)
     {
-        QVector<int> result(2 + filter.size());
-        auto range = files_by_hash.equal_range(hash);
-        for (auto iter = range.first; iter != range.second; ++iter)
-        {
-            ++result[0];
-            if (iter.value().key() == ignore) continue;
-            auto fm = iter.value()->file_mode;
-            if (!fm) {++result[1]; continue;}
-            int idx = 2;
-            for(auto tst: filter)
-            {
-                if (fm & tst) ++result[idx]; else
-                if (!(tst & FNM_Hide) && (fm & FNM_Hide)) break; // If we do not test for Hide but current item is Hiddeen - stop processing futher filter items
-                ++idx;
-            }
-        }
-        return result;
+        auto& g = groups[ent.hash];
+        count_mode(g, ent.file_mode, -1);
+        count_mode(g, mode, 1);
+        ent.file_mode = mode;
     }
 
+    bool is_all_assigned(QByteArray hash) const {return groups.value(hash).unassigned == 0;}
 
-    bool is_all_assigned(QByteArray hash) {return classify(hash, {})[1] == 0; }
+    QHash<PathId, QListWidgetItem*> file_items; // Rows of ui.files
+    void clear_files();
 
     void add_error(QString);
     void sb_message(QString);
 
-    QTreeWidgetItem* add_dir(QString path);
-
-    static QString tree_item_to_path(QTreeWidgetItem* item) {return XDirTree::tree_item_to_path(item);}
+    // Full paths are kept only by scanner - rebuilt here for display and file operations
+    QString file_path(PathId file) const {return scanner->get_paths().path(file);}
+    PathId file_id(QString path) const {return scanner->get_paths().find(path);}
 
     QIcon get_icon(FileNodeModes mode);
 
-    void set_file_mode(QString fname, FileNodeModes mode);
-    void set_file_mode_rec(QTreeWidgetItem* root, FileNodeModes);
-    void hide_file(QString fname);
-    void hide_dir_item(QTreeWidgetItem*);
-    void hide_dir_tree();
-    void show_dir_tree();
+    void set_file_mode(PathId file, FileNodeModes mode);
+    void set_file_mode_rec(const QModelIndex& root, FileNodeModes);
+    void hide_file(PathId file);
+    void show_file(PathId file); // Select file in ui.dirs
 
     void set_file_mode_all(QByteArray hash, FileNodeModes new_mode);
 
-    QString get_current_file_name();
+    PathId get_current_file();
     void set_current_file_mode(FileNodeModes new_mode);
 
-    bool do_delete(QString);
+    PathId share_source(QByteArray hash); // Kept file of group, which files marked for delete will share data with
 
-    void process_prio_range(PrioDirTree&, HashPtr begin, HashPtr end);
+    void select_hash_backend(HashBackend);
 
-    void keep_me(QString file);
-    void keep_other(QString file);
+    void keep_me(PathId file);
+    void keep_other(PathId file);
 
 
 public:
@@ -138,25 +106,39 @@ public:
 
 
 public slots:
-    void scan_new_dup(QString, QByteArray);
-    void scan_new_dir(QString dir) {ui.dir_to_process->setText(dir); }
+    void scan_take_results();
     void scan_stat_update(ScanState event);
     void scan_error(QString msg) {add_error("Dir Scanner ERROR: " + msg); }
+    void delete_take_done();
+    void delete_finished();
 
     void on_actionAdd_directory_triggered(bool);
+    void on_actionResume_scan_triggered(bool);
+    void on_actionHash_fast_triggered(bool) {select_hash_backend(HB_Fast);}
+    void on_actionHash_md5_triggered(bool) {select_hash_backend(HB_Md5);}
+    void on_actionHash_sha256_triggered(bool) {select_hash_backend(HB_Sha256);}
+    void on_actionVerify_triggered(bool checked) {scanner->set_verify(checked);}
+    void on_actionHash_cache_triggered(bool checked);
+    void on_actionSerial_HDD_triggered(bool checked) {scanner->set_device_budgets(checked ? 1 : 0, 0);}
     void on_actionProcess_by_mask_triggered(bool);
 
-    void on_dirs_currentItemChanged(QTreeWidgetItem* current, QTreeWidgetItem* previous);
+    void dirs_current_changed(const QModelIndex& current);
     void on_files_currentItemChanged(QListWidgetItem* current, QListWidgetItem* previous);
 
     void on_actionScan_for_Empty_dirs_triggered(bool);
+    void on_actionShow_hardlinks_triggered(bool);
     void on_actionAuto_by_Dirs_triggered(bool);
     void on_actionRun_triggered(bool);
-    void on_actionPause_triggered(bool checked) {scanner->suspend_resume(ui.actionPause, checked);}
+    void on_actionCancel_run_triggered(bool) {deleter->cancel();}
+    void on_actionPause_triggered(bool checked)
+    {
+        if (checked) ui.actionPause->setDisabled(true); // Until dirs in work are finished
+        scanner->suspend_resume(checked);
+    }
     void on_actionShow_processed_entries_triggered(bool);
 
-    void on_actionKeep_me_triggered(bool) { keep_me(get_current_file_name()); }
-    void on_actionKeep_other_triggered(bool) {keep_other(get_current_file_name()); }
+    void on_actionKeep_me_triggered(bool) { keep_me(get_current_file()); }
+    void on_actionKeep_other_triggered(bool) {keep_other(get_current_file()); }
     void on_actionKeep_triggered(bool) { set_current_file_mode(FNM_Keep); }
     void on_actionKeep_as_intended_duplicate_triggered(bool);
     void on_actionRemove_triggered(bool) { set_current_file_mode(FNM_Delete); }
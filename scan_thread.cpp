@@ -1,184 +1,794 @@
 #include "stdafx.h"
 
-#include <QCryptographicHash>
 #include <QtConcurrent>
+#include <QSaveFile>
+#include <QStandardPaths>
 
 #include "scan_thread.h"
+#include "file_reader.h"
+#include "file_compare.h"
+#include "uring_reader.h"
 
-void ScanThread::do_scan_dir(QString dir)
+namespace {
+thread_local int current_worker = -1;
+
+const char checkpoint_magic[8] = {'D', 'D', 'U', 'P', 'C', 'P', 0, 3};
+
+QDataStream& operator<<(QDataStream& out, const FileStat& st) {return out << st.dev << st.ino << st.size << st.mtime_ns << st.nlink;}
+QDataStream& operator>>(QDataStream& in, FileStat& st) {return in >> st.dev >> st.ino >> st.size >> st.mtime_ns >> st.nlink;}
+QDataStream& operator<<(QDataStream& out, const Digest& d) {out.writeRawData((const char*)d.bytes, sizeof(d.bytes)); return out;}
+QDataStream& operator>>(QDataStream& in, Digest& d) {in.readRawData((char*)d.bytes, sizeof(d.bytes)); return in;}
+}
+
+ScanThread::Counters& ScanThread::counters()
 {
-    emit new_dir(dir);
+    return current_worker >= 0 ? *worker_counters[current_worker] : *worker_counters.back();
+}
 
-    QStringList empty_dir_template(QFileInfo(dir).absoluteFilePath());
-    bool is_empty = true;
+ScanState ScanThread::collect_state()
+{
+    ScanState state{};
+    auto add = [&state](const Counters& c) {
+        state.total_files += c.total_files.load(std::memory_order_relaxed);
+        state.total_dups += c.total_dups.load(std::memory_order_relaxed);
+        state.total_false_dups += c.total_false_dups.load(std::memory_order_relaxed);
+        state.verified_files += c.verified_files.load(std::memory_order_relaxed);
+        state.verified_bytes += c.verified_bytes.load(std::memory_order_relaxed);
+        state.verify_ns += c.verify_ns.load(std::memory_order_relaxed);
+        state.cached_hashes += c.cached_hashes.load(std::memory_order_relaxed);
+        state.total_hardlinks += c.total_hardlinks.load(std::memory_order_relaxed);
+        state.bytes_read += c.bytes_read.load(std::memory_order_relaxed);
+        state.bytes_hashed += c.bytes_hashed.load(std::memory_order_relaxed);
+    };
+    for (const auto& c : worker_counters) add(*c);
+    add(resumed_counters);
+    auto s = dirs.stat();
+    state.total_dirs = s.first;
+    state.dirs_to_proceed = s.second;
+    state.elapsed_ms = scan_timer.isValid() ? scan_timer.elapsed() : 0;
+    return state;
+}
 
-    for (const auto& ent : QDir(dir).entryInfoList())
+void ScanThread::run()
+{
+    for (int i = 0; i <= worker_count; ++i) worker_counters.push_back(std::make_unique<Counters>());
+    for (int i = 0; i < worker_count; ++i)
     {
-        if (ent.isSymLink()) continue;
-        if (ent.isFile()) {try_file_short(ent.absoluteFilePath()); is_empty = false;} else
-        if (ent.isDir() && ent.fileName() != "." && ent.fileName() != "..") {queue.push(ent.absoluteFilePath()); empty_dir_template << ent.fileName();}
-        else continue;
+        workers << QThread::create([this, i]() {current_worker = i; worker_loop(i);});
+        workers.back()->start();
+    }
 
-        auto s = queue.stat();
-        counters.total_dirs = s.first;
-        counters.dirs_to_proceed = s.second;
-        emit stat_update(counters);
+    // Commands are executed as they come, progress is published between them at fixed rate - only if something was changed
+    ScanState last_state{};
+    QElapsedTimer stat_timer;
+    stat_timer.start();
+    QElapsedTimer checkpoint_timer;
+    checkpoint_timer.start();
+    bool saved_complete = true; // Checkpoint of finished scan is written once
+    for (;;)
+    {
+        Cmd cmd;
+        bool has_cmd = queue.pop(cmd, std::max<int>(0, STAT_PERIOD_MS - stat_timer.elapsed()));
+        if (stat_timer.elapsed() >= STAT_PERIOD_MS)
+        {
+            stat_timer.restart();
+            if (!scan_timer.isValid() && dirs.stat().first) scan_timer.start();
+            ScanState state = collect_state();
+            state.elapsed_ms = last_state.elapsed_ms;
+            if (memcmp(&state, &last_state, sizeof(state)) != 0)
+            {
+                state.elapsed_ms = scan_timer.isValid() ? scan_timer.elapsed() : 0;
+                last_state = state;
+                emit stat_update(state);
+            }
+        }
+        if (!checkpoint_path.isEmpty())
+        {
+            auto [total, pending] = dirs.stat();
+            if (pending) saved_complete = false;
+            if ((pending && checkpoint_timer.elapsed() >= CHECKPOINT_PERIOD_MS) || (total && !pending && !saved_complete))
+            {
+                save_checkpoint();
+                checkpoint_timer.restart();
+                saved_complete = !pending;
+            }
+        }
+        if (!has_cmd) continue;
+        switch(cmd.command)
+        {
+            case CC_Exit:
+            {
+                dirs.stop();
+                for (auto w : workers) w->wait();
+                return;
+            }
+            case CC_RemoveFile:
+            {
+                QMutexLocker<QMutex> l(&store_mutex);
+                auto slot = dups_files_store.find(Digest::from(cmd.hash));
+                if (slot && slot->group >= 0)
+                {
+                    dup_groups[slot->group].files.remove(cmd.file);
+                    dup_groups[slot->group].verified.remove(cmd.file);
+                }
+                break;
+            }
+            case CC_Checkpoint:
+            {
+                if (!checkpoint_path.isEmpty() && dirs.stat().first) save_checkpoint(); // Don't overwrite previous one with nothing
+                break;
+            }
+            case CC_ResetReported:
+            {
+                QMutexLocker<QMutex> l(&store_mutex);
+                for(auto& ff: dup_groups) ff.reported = false;
+                break;
+            }
+        }
     }
-    if (is_empty)
+}
+
+// Workers are not terminated - they may hold store or results mutex. They leave as soon as their current dir is finished.
+ScanThread::~ScanThread()
+{
+    dirs.stop();
+    for (auto w : workers)
     {
-        QMutexLocker<QMutex> l(&empty_dirs_mutex);
-        empty_dirs << empty_dir_template;
+        w->wait();
+        delete w;
     }
 }
 
-QByteArray eval_hash(const void* data, uint64_t size, bool partial)
+void ScanThread::worker_loop(int worker)
 {
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    md5.addData(QByteArray((const char*)&size, sizeof(size)));
-    md5.addData(QByteArrayView((const char*)data, partial ? std::min<uint64_t>(START_SCAN_SIZE, size) : size));
-    return md5.result();
+    DirPool::Entry ent;
+    while (dirs.pop(worker, ent))
+    {
+        do_scan_dir(worker, ent.dir, ent.dev);
+        // Compaction of big cache takes time - done here, not on exit. Workers which start meanwhile wait in lookup.
+        if (dirs.finish(ent) && hash_cache) hash_cache->compact_if_needed();
+    }
 }
 
-bool ScanThread::try_file_short(QString file)
+void ScanThread::do_scan_dir(int worker, PathId dir_id, quint64 dev)
 {
-    QFile f(file);
-    if (!f.open(QIODeviceBase::ReadOnly))
+    QString dir = paths.path(dir_id);
+    current_dir.store(dir_id, std::memory_order_relaxed);
+
+    DirReader listing;
+    if (!listing.open(dir))
     {
-        emit error("Can't open file '" + file + "'");
-        return false;
+        emit error("Can't read directory '" + dir + "'");
+        dir_finished(dir_id, 0, true); // Unknown content - not empty
+        return;
     }
-    ++counters.total_files;
-    qint64 size = f.size();
-    if (!size) return false;
-    uchar* data = f.map(0, size);
-    if (!data)
+    QString prefix = dir.endsWith('/') ? dir : dir + '/';
+    bool is_empty = true;
+    int subdirs = 0;
+    // First hash step of candidates from this dir is read in batches when io_uring is available
+    UringReader* reader = io_queue_depth ? UringReader::for_thread(io_queue_depth) : nullptr;
+    QVector<PendingFile> batch;
+
+    DirReader::Entry ent;
+    while (listing.next(ent))
     {
-        emit error("Can't map file '" + file + "' to memory");
-        return false;
+        if (is_excluded(ent.name))
+        {
+            is_empty = false; // Skipped entry is still there - removing dir as empty would lose it
+            continue;
+        }
+        PathId id = paths.intern(dir_id, ent.name);
+        if (id == PathStore::NoPath)
+        {
+            emit error("Too many paths - '" + prefix + ent.name + "' is skipped");
+            is_empty = false; // Not known
+            continue;
+        }
+        if (!ent.is_dir)
+        {
+            try_file_size(PendingFile{id, ent.st, ent.has_stat}, reader ? &batch : nullptr);
+            if (batch.size() >= qsizetype(io_queue_depth)) hash_batch(*reader, batch);
+            is_empty = false;
+        }
+        else
+        {
+            // Mount point inside scanned tree belongs to other device
+            FileStat st;
+            quint64 sub_dev = ent.has_stat ? ent.st.dev : get_file_stat(prefix + ent.name, st) ? st.dev : dev;
+            dirs.push(worker, id, sub_dev);
+            ++subdirs;
+        }
     }
-    QByteArray hash = eval_hash(data, size, true);
-    if (short_files_store.contains(hash))
+    if (!batch.isEmpty()) hash_batch(*reader, batch);
+    dir_finished(dir_id, subdirs, !is_empty);
+}
+
+// Subdir already finished earlier (visited as scan root) was counted in parent's node then - it is counted here again
+void ScanThread::dir_finished(PathId dir, int subdirs, bool has_files)
+{
+    QMutexLocker<QMutex> l(&empty_dirs_mutex);
+    EmptyNode* node = &empty_pending[dir];
+    node->pending += subdirs;
+    node->listed = true;
+    node->has_files |= has_files;
+    while (node->listed && node->pending == 0)
     {
-        QSet<QString>& files = short_files_store[hash];
-        if (files.contains(file)) return false;
-        QString old_file = *files.begin();
-        files.insert(file);
-        switch(files.size())
+        bool files = node->has_files;
+        empty_pending.remove(dir);
+        if (!files) empty_dirs.insert(dir);
+        dir = paths.parent(dir);
+        if (dir == PathStore::NoPath) break;
+        node = &empty_pending[dir]; // Parent of scan root is never listed - it stays pending
+        --node->pending;
+        node->has_files |= files;
+    }
+}
+
+// Bucket file by size (known from directory enumeration). File contents are not touched until its size become not unique.
+// With 'batch' first hash step is not done here - candidates are added to batch instead.
+bool ScanThread::try_file_size(PendingFile pf, QVector<PendingFile>* batch)
+{
+    qint64 size = pf.st.size;
+    PendingFile first;
+    {
+        bump(counters().total_files);
+        if (size < min_file_size) return false;
+        QMutexLocker<QMutex> l(&store_mutex);
+        auto iter = size_files_store.find(size);
+        if (iter == size_files_store.end())
         {
-            case 0: case 1: return false; // Unique file
-            case 2: // Switch from unique to full - Fill both files
-            {
-                bool result = try_file_full(old_file, 0);
-                return try_file_full(file, data, size, 2) || result;
-            }
-            default: // Already not unique - just add me
-                return try_file_full(file, data, size, 1);
+            size_files_store.insert(size, pf);
+            return false;
         }
+        first = std::exchange(iter.value(), PendingFile());
     }
-    else
+    // Second file of this size - process delayed first one too. Same size alone is not counted as 'fake' dup.
+    // Inodes of both files are registered before any hashing, so extra link to the first file is not hashed at all.
+    bool first_ok = first.file != PathStore::NoPath && complete_stat(first) && !is_extra_link(first.file, first.st);
+    bool file_ok = complete_stat(pf) && !is_extra_link(pf.file, pf.st);
+
+    if (batch)
     {
-        short_files_store[hash].insert(file);
+        if (first_ok) *batch << first;
+        if (file_ok) *batch << pf;
         return false;
     }
+    QByteArray size_key((const char*)&size, sizeof(size));
+    bool result = first_ok && try_file_step(first.file, first.st, 0, size_key, 0);
+    return (file_ok && try_file_step(pf.file, pf.st, 0, size_key, 0)) || result;
 }
 
-// Add new full Hash.
-bool ScanThread::try_file_full(QString file, int fake_dups_weight)
+// Read file identity if enumeration gave only its size
+bool ScanThread::complete_stat(PendingFile& pf)
 {
-    QFile f(file);
-    if (!f.open(QIODeviceBase::ReadOnly))
+    if (pf.has_stat) return true;
+    qint64 size = pf.st.size;
+    QString file = paths.path(pf.file);
+    if (!get_file_stat(file, pf.st))
     {
-        emit error("Can't reopen file '" + file + "'");
+        emit error("Can't get info for file '" + file + "'");
         return false;
     }
-    qint64 size = f.size();
-    uchar* data = f.map(0, size);
-    if (!data)
+    if (pf.st.size != size)
     {
-        emit error("Can't remap file '" + file + "' to memory");
+        emit error("File '" + file + "' was changed during scan");
         return false;
     }
-    return try_file_full(file, data, size, fake_dups_weight);
+    pf.has_stat = true;
+    return true;
+}
+
+// Register inode of file with several links. Return true if this inode was already seen - file is just one more link to it.
+bool ScanThread::is_extra_link(PathId file, const FileStat& st)
+{
+    if (st.nlink <= 1) return false;
+    QMutexLocker<QMutex> l(&store_mutex);
+    PathId& ent = inode_files_store[qMakePair(st.dev, st.ino)];
+    if (ent == PathStore::NoPath) {ent = file; return false;}
+    hardlinks_store[ent] << file;
+    bump(counters().total_hardlinks);
+    return true;
 }
 
-bool ScanThread::try_file_full(QString file, const void* file_image, size_t file_size, int fake_dups_weight)
+QMap<QString, QStringList> ScanThread::get_hardlinks()
 {
-    bool result = false;
-    QByteArray hash = eval_hash(file_image, file_size, false);
-    if (dups_files_store.contains(hash))
+    QMutexLocker<QMutex> l(&store_mutex);
+    QMap<QString, QStringList> result;
+    for (const auto& [primary, links] : hardlinks_store.asKeyValueRange())
     {
-        if (fake_dups_weight) result = true;
-        auto& ent = dups_files_store[hash];
-        assert(!ent.files.contains(file));
-        if (!ent.reported) // Switch from 'fake' to real dups - emit both entries
+        auto& lst = result[paths.path(primary)];
+        for (auto link : links) lst << paths.path(link);
+    }
+    return result;
+}
+
+// Hash ranges of file (with key of previous step as prefix)
+bool ScanThread::hash_file_ranges(QString file, QByteArray prev_key, const HashStep& step, QByteArray& key)
+{
+    FileReader reader;
+    if (!reader.open(file))
+    {
+        emit error("Can't open file '" + file + "'");
+        return false;
+    }
+    Hasher hasher(hash_backend);
+    hasher.add(prev_key.constData(), prev_key.size());
+    for (const auto& [offset, length] : step.ranges)
+    {
+        auto& c = counters();
+        if (!reader.read(offset, length, [&hasher, &c](const char* data, qint64 size) {hasher.add(data, size); bump(c.bytes_read, size); bump(c.bytes_hashed, size);}))
         {
-            for(const auto f: ent.files)  emit new_dup(f, hash);
-            ++counters.total_dups;
+            emit error("Can't read file '" + file + "' (file was changed during scan?)");
+            return false;
+        }
+    }
+    key = hasher.result();
+    return true;
+}
+
+bool ScanThread::cached_key(const FileStat& st, int step, QByteArray& key)
+{
+    if (!hash_cache || !hash_cache->lookup(HashCache::make_key(st, hash_backend, stages_id, step), key)) return false;
+    bump(counters().cached_hashes);
+    return true;
+}
+
+void ScanThread::store_key(PathId file, const FileStat& st, int step, QByteArray key)
+{
+    if (!hash_cache) return;
+    // Do not cache hash of file which was changed while we read it
+    FileStat st2;
+    if (get_file_stat(paths.path(file), st2) && st2.mtime_ns == st.mtime_ns && st2.size == st.size) hash_cache->insert(HashCache::make_key(st, hash_backend, stages_id, step), key);
+}
+
+// Hash first step of several files. Reads are submitted together, hashing and grouping are done as reads complete.
+void ScanThread::hash_batch(UringReader& reader, QVector<PendingFile>& batch)
+{
+    QVector<UringReader::Job> jobs;
+    QVector<PendingFile> job_files;
+    for (const auto& pf : batch)
+    {
+        QByteArray key;
+        if (cached_key(pf.st, 0, key)) {try_file_key(pf.file, pf.st, 0, key, 0); continue;}
+        auto plan = plan_hash_steps(hash_stages, pf.st.size);
+        qint64 total = 0;
+        for (const auto& range : plan[0].ranges) total += range.second;
+        if (total > UringReader::MAX_JOB_SIZE)
+        {
+            try_file_step(pf.file, pf.st, 0, QByteArray((const char*)&pf.st.size, sizeof(pf.st.size)), 0);
+            continue;
+        }
+        jobs << UringReader::Job{paths.path(pf.file), plan[0].ranges};
+        job_files << pf;
+    }
+    batch.clear();
+
+    // Completion only hashes data just read (small, bounded work), so ring stays full. Grouping, which may go through
+    // later stages and verification reading much more, runs when whole batch is read.
+    QVector<QByteArray> keys(jobs.size());
+    auto hash_job = [&](int i) {
+        if (jobs[i].result != UringReader::JR_Ok) return;
+        const auto& st = job_files[i].st;
+        Hasher hasher(hash_backend);
+        hasher.add((const char*)&st.size, sizeof(st.size));
+        hasher.add(jobs[i].data.constData(), jobs[i].data.size());
+        bump(counters().bytes_read, jobs[i].data.size());
+        bump(counters().bytes_hashed, jobs[i].data.size());
+        keys[i] = hasher.result();
+        jobs[i].data = QByteArray(); // Not needed anymore - release memory while other reads go on
+    };
+    if (!jobs.isEmpty()) reader.read(jobs, hash_job);
+
+    for (int i = 0; i < jobs.size(); ++i)
+    {
+        const auto& [file, st, has_stat] = job_files[i];
+        switch (jobs[i].result)
+        {
+            case UringReader::JR_Pending: // io_uring failed - read it here
+                try_file_step(file, st, 0, QByteArray((const char*)&st.size, sizeof(st.size)), 0);
+                break;
+            case UringReader::JR_OpenError:
+                emit error("Can't open file '" + jobs[i].file + "'");
+                break;
+            case UringReader::JR_ReadError:
+                emit error("Can't read file '" + jobs[i].file + "' (file was changed during scan?)");
+                break;
+            case UringReader::JR_Ok:
+                store_key(file, st, 0, keys[i]);
+                try_file_key(file, st, 0, keys[i], 0);
+                break;
+        }
+    }
+}
+
+// Hash next step of file. File proceeds to following step only if it is not unique on this one.
+bool ScanThread::try_file_step(PathId file, const FileStat& st, int step, QByteArray prev_key, int fake_dups_weight)
+{
+    QByteArray key;
+    if (!cached_key(st, step, key))
+    {
+        if (!hash_file_ranges(paths.path(file), prev_key, plan_hash_steps(hash_stages, st.size)[step], key)) return false;
+        store_key(file, st, step, key);
+    }
+    return try_file_key(file, st, step, key, fake_dups_weight);
+}
+
+// Group file by key of hash step
+bool ScanThread::try_file_key(PathId file, const FileStat& st, int step, QByteArray key, int fake_dups_weight)
+{
+    qint64 size = st.size;
+    auto plan = plan_hash_steps(hash_stages, size);
+    if (plan[step].complete) return try_file_full(file, size, key, fake_dups_weight);
+
+    PathId old_file = PathStore::NoPath;
+    FileStat old_st;
+    quint32 group_size;
+    {
+        QMutexLocker<QMutex> l(&store_mutex);
+        auto [grp, inserted] = stage_files_store[plan[step].stage].insert(Digest::from(key));
+        if (inserted) {grp->first = file; grp->first_st = st;}
+        else if (grp->first == file) return false;
+        else if (grp->size == 1) {old_file = grp->first; old_st = grp->first_st; grp->first = PathStore::NoPath;}
+        group_size = ++grp->size;
+    }
+    // Next step evaluated out of lock - other workers can proceed with their files
+    switch(group_size)
+    {
+        case 0: case 1: return false; // Unique file
+        case 2: // Switch from unique to next step - Fill both files
+        {
+            bool result = try_file_step(old_file, old_st, step + 1, key, 0);
+            return try_file_step(file, st, step + 1, key, 2) || result;
+        }
+        default: // Already not unique - just add me
+            return try_file_step(file, st, step + 1, key, 1);
+    }
+}
+
+// Add new full Hash.
+bool ScanThread::try_file_full(PathId file, qint64 size, QByteArray hash, int fake_dups_weight)
+{
+    QMutexLocker<QMutex> l(&store_mutex);
+    auto [slot, inserted] = dups_files_store.insert(Digest::from(hash));
+    if (inserted)
+    {
+        slot->first = file;
+        bump(counters().total_false_dups, fake_dups_weight);
+        return false;
+    }
+    // Real duplicate - 'fake' dup weight is not added
+    int group = slot->group;
+    if (group < 0)
+    {
+        assert(slot->first != file);
+        group = slot->group = int(dup_groups.size());
+        dup_groups.push_back(DupFilesEntry{{slot->first}});
+        slot->first = PathStore::NoPath;
+    }
+    auto& ent = dup_groups[group];
+    assert(!ent.files.contains(file));
+    ent.files.insert(file);
+
+    if (!verify_dups)
+    {
+        if (!ent.reported) // Switch from 'fake' to real dups - emit all entries
+        {
+            for(const auto& f: ent.files) report_dup(f, hash);
+            bump(counters().total_dups, ent.files.size());
             ent.reported = true;
         }
+        else
+        {
+            report_dup(file, hash);
+            bump(counters().total_dups);
+        }
+        return true;
+    }
 
-        emit new_dup(file, hash);
-        ent.files.insert(file);
-        ++counters.total_dups;
-        fake_dups_weight = 0; // Real duplicate - reset 'fake' dup weight, it will not updated
+    // Files are reported only after byte-by-byte verification. One worker verifies group at a time, files added meanwhile
+    // are picked up by it in next round.
+    if (ent.verifying) return true;
+    ent.verifying = true;
+    for (;;)
+    {
+        auto& grp = dup_groups[group];
+        QVector<PathId> to_compare;
+        if (!grp.verified.isEmpty()) to_compare << *grp.verified.begin(); // Reference
+        for (const auto& f : grp.files)
+        {
+            if (!grp.verified.contains(f)) to_compare << f;
+        }
+        if (to_compare.size() < 2)
+        {
+            grp.verifying = false;
+            break;
+        }
+        l.unlock();
+        QStringList names;
+        for (auto f : to_compare) names << paths.path(f);
+        qint64 bytes = 0;
+        QElapsedTimer verify_timer;
+        verify_timer.start();
+        auto same = compare_files(names, size, &bytes);
+        bump(counters().verify_ns, verify_timer.nsecsElapsed());
+        l.relock();
+
+        auto& grp2 = dup_groups[group];
+        bump(counters().verified_bytes, bytes);
+        bump(counters().bytes_read, bytes);
+        if (!same[0]) // Reference can't be read - drop it and try again with the rest
+        {
+            grp2.files.remove(to_compare[0]);
+            grp2.verified.remove(to_compare[0]);
+            emit error("Can't read file '" + names[0] + "' for verification");
+            continue;
+        }
+        QVector<PathId> matched;
+        for (int i = 0; i < to_compare.size(); ++i)
+        {
+            PathId f = to_compare[i];
+            if (grp2.verified.contains(f) || !grp2.files.contains(f)) continue; // Reference or file removed meanwhile
+            if (same[i]) matched << f; else
+            {
+                grp2.files.remove(f);
+                emit error("File '" + names[i] + "' has the same hash as '" + names[0] + "', but different contents (or can't be read)");
+            }
+        }
+        if (grp2.verified.isEmpty() && matched.size() < 2) continue; // Nothing confirmed - group is gone
+        for (const auto& f : matched) grp2.verified.insert(f);
+        bump(counters().verified_files, matched.size());
+        if (!grp2.reported) {matched = grp2.verified.values(); grp2.reported = true;}
+        for (const auto& f : matched) report_dup(f, hash);
+        bump(counters().total_dups, matched.size());
     }
-    dups_files_store[hash].files.insert(file);
-    counters.total_false_dups += fake_dups_weight;
-    return result;
+    return true;
+}
+
+bool ScanThread::set_hash_cache(QString path)
+{
+    if (dirs.stat().first) return false;
+    hash_cache.reset();
+    if (path.isEmpty()) return true;
+    hash_cache = std::make_unique<HashCache>();
+    if (hash_cache->open(path)) return true;
+    hash_cache.reset();
+    return false;
 }
 
-void ScanThread::suspend_resume(QAction* action, bool checked)
+void ScanThread::suspend_resume(bool checked)
 {
     if (checked)
     {
-        expect_suspend = true;
-        action->setDisabled(true);
-        suspend_action = action;
-        suspend_watcher.setFuture(QtConcurrent::run([this]() {suspend_mutex.lock();}));
+        suspend_watcher.setFuture(QtConcurrent::run([this]() {dirs.hold();}));
     }
     else
     {
-        expect_suspend = false; 
-        suspend_mutex.unlock();
+        dirs.release();
     }
 }
 
 QStringList ScanThread::get_empty_dirs()
 {
-    struct EmptyDirProto {
-        bool me_empty = true;
-        bool parent_empty = false;
-    };
-    QMap<QString, EmptyDirProto> accumulated_empty_dirs;
+    QVector<PathId> top;
     {
         QMutexLocker<QMutex> l(&empty_dirs_mutex);
-        for (size_t idx = empty_dirs.size(); idx--;)
+        for (auto dir : empty_dirs)
         {
-            const auto& ent = empty_dirs[idx];
-            EmptyDirProto data;
-            for (size_t i = 1; i < ent.size(); ++i)
-            {
-                QString path = ent[0] + "/" + ent[i];
-                if (!accumulated_empty_dirs.contains(path) || !accumulated_empty_dirs[path].me_empty)
-                {
-                    data.me_empty = false;
-                    break;
-                }
-            }
-            accumulated_empty_dirs[ent[0]] = data;
-            if (data.me_empty)
+            if (!empty_dirs.contains(paths.parent(dir))) top << dir;
+        }
+    }
+    QStringList result;
+    for (auto dir : top) result << paths.path(dir);
+    result.sort();
+    return result;
+}
+
+QString ScanThread::default_checkpoint_path()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/ddup/checkpoint.bin";
+}
+
+bool ScanThread::save_checkpoint()
+{
+    QMutexLocker<QMutex> l(&roots_mutex); // No new root meanwhile
+    // Every visited dir is either finished or queued now, stores are not changed
+    if (checkpoint_cancelled || !dirs.hold()) return false;
+    bool ok = write_checkpoint();
+    dirs.release();
+    l.unlock();
+    if (!ok && !checkpoint_cancelled) emit error("Can't write checkpoint '" + checkpoint_path + "'");
+    return ok;
+}
+
+// Layout: magic, hash settings, paths, stores, empty dirs, counters, dir pool. Stores are written as they are (ids
+// are the same after load), so resumed session continues exactly where this one stopped.
+// Cancelled write is dropped (QSaveFile is not committed) - previous file stays.
+bool ScanThread::write_checkpoint()
+{
+    QDir().mkpath(QFileInfo(checkpoint_path).absolutePath());
+    QSaveFile f(checkpoint_path);
+    if (!f.open(QIODeviceBase::WriteOnly)) return false;
+    QDataStream out(&f);
+    out.setVersion(QDataStream::Qt_6_0);
+    out.writeRawData(checkpoint_magic, sizeof(checkpoint_magic));
+    out << quint8(hash_backend) << hash_stages_to_string(hash_stages) << bool(verify_dups);
+
+    paths.save(out);
+    if (checkpoint_cancelled) return false;
+    {
+        QMutexLocker<QMutex> l(&store_mutex);
+        out << quint64(size_files_store.size());
+        for (const auto& [size, pf] : size_files_store.asKeyValueRange()) out << size << pf.file << pf.st << pf.has_stat;
+        out << inode_files_store << hardlinks_store;
+        for (auto& table : stage_files_store)
+        {
+            if (checkpoint_cancelled) return false;
+            out << quint64(table.size());
+            table.for_each([&out](const Digest& key, const StageGroup& g) {out << key << g.first << g.size << g.first_st;});
+        }
+        out << quint64(dups_files_store.size());
+        dups_files_store.for_each([&out](const Digest& key, const DupSlot& slot) {out << key << slot.first << slot.group;});
+        out << quint64(dup_groups.size());
+        for (const auto& g : dup_groups) out << g.files << g.verified << g.reported;
+    }
+    if (checkpoint_cancelled) return false;
+    {
+        QMutexLocker<QMutex> l(&empty_dirs_mutex);
+        out << quint64(empty_pending.size());
+        for (const auto& [dir, node] : empty_pending.asKeyValueRange()) out << dir << node.pending << node.listed << node.has_files;
+        out << empty_dirs;
+    }
+    ScanState s = collect_state();
+    out << quint64(s.total_files) << quint64(s.total_dups) << quint64(s.total_false_dups) << quint64(s.verified_files)
+        << s.verified_bytes << s.verify_ns << quint64(s.cached_hashes) << quint64(s.total_hardlinks) << s.bytes_read << s.bytes_hashed;
+    dirs.save(out);
+
+    return !checkpoint_cancelled && out.status() == QDataStream::Ok && f.commit();
+}
+
+bool ScanThread::resume(QString path)
+{
+    if (dirs.stat().first || paths.size() != 1) return false;
+    QFile f(path);
+    if (!f.open(QIODeviceBase::ReadOnly)) return false;
+    QDataStream in(&f);
+    in.setVersion(QDataStream::Qt_6_0);
+    char magic[sizeof(checkpoint_magic)];
+    if (in.readRawData(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, checkpoint_magic, sizeof(magic)) != 0) return false;
+
+    quint8 backend = 0;
+    QString stages_text;
+    bool verify = false;
+    in >> backend >> stages_text >> verify;
+    QVector<HashStage> stages;
+    if (backend > HB_Sha256 || !parse_hash_stages(stages_text, stages)) return false;
+
+    if (read_checkpoint(in, HashBackend(backend), stages, verify)) return true;
+    // Broken file - drop what was loaded. Hash settings are not changed.
+    QMutexLocker<QMutex> l(&store_mutex);
+    size_files_store.clear();
+    inode_files_store.clear();
+    hardlinks_store.clear();
+    for (auto& table : stage_files_store) table.clear();
+    dups_files_store.clear();
+    dup_groups.clear();
+    paths.clear();
+    return false;
+}
+
+// Every loaded PathId is checked against loaded PathStore - broken file must not lead to access out of it
+bool ScanThread::read_checkpoint(QDataStream& in, HashBackend backend, const QVector<HashStage>& stages, bool verify)
+{
+    if (!paths.load(in)) return false;
+    PathId path_count = PathId(paths.size());
+    bool valid = true;
+    auto check = [&](PathId id) {valid &= id < path_count;};
+    QVector<DigestTable<StageGroup>> stage_tables(stages.size());
+    {
+        QMutexLocker<QMutex> l(&store_mutex);
+        quint64 count = 0;
+        in >> count;
+        for (quint64 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+        {
+            qint64 size = 0;
+            PendingFile pf;
+            in >> size >> pf.file >> pf.st >> pf.has_stat;
+            check(pf.file);
+            size_files_store.insert(size, pf);
+        }
+        in >> inode_files_store >> hardlinks_store;
+        for (auto id : std::as_const(inode_files_store)) check(id);
+        for (const auto& [primary, links] : hardlinks_store.asKeyValueRange())
+        {
+            check(primary);
+            for (auto id : links) check(id);
+        }
+        for (auto& table : stage_tables)
+        {
+            in >> count;
+            for (quint64 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
             {
-                for (size_t i = 0; i < ent.size(); ++i)
-                {
-                    accumulated_empty_dirs[ent[0] + "/" + ent[i]].parent_empty = true;
-                }
+                Digest key;
+                StageGroup g;
+                in >> key >> g.first >> g.size >> g.first_st;
+                check(g.first);
+                *table.insert(key).first = g;
             }
         }
+        in >> count;
+        for (quint64 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+        {
+            Digest key;
+            DupSlot slot;
+            in >> key >> slot.first >> slot.group;
+            check(slot.first);
+            *dups_files_store.insert(key).first = slot;
+        }
+        in >> count;
+        for (quint64 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+        {
+            DupFilesEntry g;
+            in >> g.files >> g.verified >> g.reported;
+            for (auto id : g.files) check(id);
+            for (auto id : g.verified) check(id);
+            dup_groups.push_back(std::move(g));
+        }
+        dups_files_store.for_each([&](const Digest&, const DupSlot& slot) {valid &= slot.group < qint64(dup_groups.size());});
+        if (!valid) return false;
     }
-    QStringList result;
-    for (const auto& [fname, data] : accumulated_empty_dirs.asKeyValueRange())
+    QHash<PathId, EmptyNode> loaded_empty_pending;
+    QSet<PathId> loaded_empty_dirs;
+    quint64 count = 0;
+    in >> count;
+    for (quint64 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
     {
-        if (data.me_empty && !data.parent_empty) result << fname;
+        PathId dir;
+        EmptyNode node;
+        in >> dir >> node.pending >> node.listed >> node.has_files;
+        check(dir);
+        loaded_empty_pending.insert(dir, node);
     }
-    return result;
+    quint64 total_files, total_dups, total_false_dups, verified_files, cached_hashes, total_hardlinks;
+    qint64 verified_bytes, verify_ns, bytes_read, bytes_hashed;
+    in >> loaded_empty_dirs >> total_files >> total_dups >> total_false_dups >> verified_files >> verified_bytes >> verify_ns >> cached_hashes
+        >> total_hardlinks >> bytes_read >> bytes_hashed;
+    for (auto id : loaded_empty_dirs) check(id);
+    if (!valid || in.status() != QDataStream::Ok) return false;
+
+    // Dirs go last - workers start as soon as they are pushed
+    std::vector<DirPool::Entry> queued;
+    QByteArray visited;
+    if (!dirs.load(in, queued, visited)) return false;
+
+    // File is good - settings of resumed scan replace current ones
+    hash_backend = backend;
+    set_hash_stages(stages);
+    verify_dups = verify;
+    {
+        QMutexLocker<QMutex> l(&store_mutex);
+        stage_files_store = std::move(stage_tables);
+        dups_files_store.for_each([this](const Digest& key, const DupSlot& slot) {
+            if (slot.group < 0 || !dup_groups[slot.group].reported) return;
+            const auto& g = dup_groups[slot.group];
+            for (const auto& file : verify_dups ? g.verified : g.files) report_dup(file, key.to_bytes());
+        });
+    }
+    {
+        QMutexLocker<QMutex> l(&empty_dirs_mutex);
+        empty_pending = loaded_empty_pending;
+        empty_dirs = loaded_empty_dirs;
+    }
+    resumed_counters.total_files = total_files;
+    resumed_counters.total_dups = total_dups;
+    resumed_counters.total_false_dups = total_false_dups;
+    resumed_counters.verified_files = verified_files;
+    resumed_counters.verified_bytes = verified_bytes;
+    resumed_counters.verify_ns = verify_ns;
+    resumed_counters.cached_hashes = cached_hashes;
+    resumed_counters.total_hardlinks = total_hardlinks;
+    resumed_counters.bytes_read = bytes_read;
+    resumed_counters.bytes_hashed = bytes_hashed;
+
+    dirs.restore(queued, visited);
+    return true;
 }
@@ -1,16 +1,31 @@
 #pragma once
 
 #include <QThread>
+#include <QDataStream>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QSemaphore>
+#include <QWaitCondition>
 #include <QAtomicInteger>
 #include <QFutureWatcher>
 #include <QFuture>
 #include <QVector>
+#include <QElapsedTimer>
+#include <QRegularExpression>
 
-// Size for initial Scan of file
-static constexpr size_t START_SCAN_SIZE = 4*1024;
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "hash_backend.h"
+#include "hash_stages.h"
+#include "hash_cache.h"
+#include "uring_reader.h"
+#include "device_info.h"
+#include "dir_reader.h"
+#include "path_store.h"
+#include "digest_table.h"
 
 struct ScanState {
     size_t  total_files;
@@ -18,151 +33,562 @@ struct ScanState {
     size_t  total_false_dups;
     size_t  total_dirs;
     size_t  dirs_to_proceed;
+    size_t  verified_files;
+    qint64  verified_bytes;
+    qint64  verify_ns;    // Time spent in byte-by-byte comparison, summed over workers
+    size_t  cached_hashes;
+    size_t  total_hardlinks;
+    qint64  bytes_read;   // File contents read from disk (hashing and verification)
+    qint64  bytes_hashed; // File contents hashed (not counting cached hashes)
+    qint64  elapsed_ms;   // Since first directory was added
 };
 
 class ScanThread : public QThread {
     Q_OBJECT;
 
+public:
+    struct DupResult {
+        PathId file;
+        QByteArray hash;
+    };
+
+private:
     enum CmdCode {
-        CC_Dir,
         CC_Exit,
         CC_ResetReported,
-        CC_RemoveFile
+        CC_RemoveFile,
+        CC_Checkpoint
     };
     struct Cmd {
         CmdCode command;
-        QString file;
+        PathId file;
         QByteArray hash;
     };
 
+    // Control commands. Executed in order by ScanThread::run, directories go to DirPool
     class Queue {
         QMutex queue_mutex;
         QSemaphore queue_counter;
-        QSet<QString> dirs;
-        QVector<QString> dirs_to_proceed;
-        QVector<Cmd> oob_commands;
+        QVector<Cmd> commands;
     public:
-        void push(QString d) {push(Cmd{CC_Dir, d}); }
         void push(const Cmd& cmd)
         {
             QMutexLocker<QMutex> l(&queue_mutex);
-            if (cmd.command == CC_Dir)
+            commands.push_back(cmd);
+            queue_counter.release();
+        }
+        // Wait for command up to 'timeout_ms'. Return false on timeout
+        bool pop(Cmd& result, int timeout_ms)
+        {
+            if (!queue_counter.tryAcquire(1, timeout_ms)) return false;
+            QMutexLocker<QMutex> l(&queue_mutex);
+            result = commands.front();
+            commands.pop_front();
+            return true;
+        }
+    } queue;
+
+    // All paths seen by scanner
+    PathStore paths;
+
+    // Directories to scan, grouped by device. Each device has budget - max number of workers scanning it at once
+    // (one for spinning disks, so they don't thrash on seeks; all workers for SSD). Within device each worker owns one deque:
+    // it pushes and pops its own dirs from the back (depth first, as single thread did) and steals from the front of other deques.
+    // Budget covers listing of dir and hashing of its files only. File of other device can still be read by any worker -
+    // first file of size group seen earlier elsewhere, or dups compared in verify mode - so spinning disk may get more
+    // readers than its budget.
+    class DirPool {
+    public:
+        struct Entry {
+            PathId dir = PathStore::NoPath;
+            quint64 dev = 0;
+        };
+
+    private:
+        struct Device {
+            bool rotational = false;
+            int budget = 0; // 0 - no limit
+            int active = 0; // Workers scanning dirs of this device
+            size_t queued = 0;
+            std::vector<std::deque<PathId>> deques; // One per worker
+        };
+        QMutex mutex; // Guards everything except 'visited' and 'pending'
+        QWaitCondition available;
+        QWaitCondition idle; // No dir in work
+        int in_work = 0; // Dirs between 'pop' and 'finish'
+        int holds = 0; // Dirs are not given to workers while held (pause, checkpoint)
+        bool holds_cancelled = false;
+        QHash<quint64, Device> devices;
+        int workers = 1;
+        int rotational_budget = 1;
+        int solid_budget = 0;
+        size_t next_external = 0; // Round robin for dirs pushed from outside of workers
+        bool exiting = false;
+        const PathStore& paths;
+        QMutex visited_mutex;
+        std::vector<bool> visited; // Indexed by dir id
+        size_t visited_count = 0;
+        QAtomicInteger<size_t> pending = 0; // Pushed but not yet finished dirs
+
+        bool take(int worker, Entry& ent)
+        {
+            Device* steal = nullptr;
+            quint64 steal_dev = 0;
+            for (auto iter = devices.begin(); iter != devices.end(); ++iter)
             {
-                if (dirs.contains(cmd.file)) return;
-                dirs_to_proceed.push_back(cmd.file);
-                dirs.insert(cmd.file);
+                Device& d = iter.value();
+                if (!d.queued || (d.budget && d.active >= d.budget)) continue;
+                auto& own = d.deques[worker];
+                if (!own.empty()) {ent = {std::move(own.back()), iter.key()}; own.pop_back(); --d.queued; ++d.active; return true;}
+                if (!steal) {steal = &d; steal_dev = iter.key();}
             }
-            else
+            if (!steal) return false;
+            ent.dev = steal_dev;
+            for (size_t i = 1; i < steal->deques.size(); ++i)
             {
-                oob_commands.push_back(cmd);
+                auto& dq = steal->deques[(worker + i) % steal->deques.size()];
+                if (!dq.empty()) {ent.dir = std::move(dq.front()); dq.pop_front(); --steal->queued; ++steal->active; return true;}
+            }
+            return false;
+        }
+
+        // Under 'mutex'. Device is created on first dir of it.
+        Device& device(quint64 dev, bool rotational)
+        {
+            auto iter = devices.find(dev);
+            if (iter == devices.end())
+            {
+                Device d;
+                d.rotational = rotational;
+                d.budget = d.rotational ? rotational_budget : solid_budget;
+                d.deques.resize(workers);
+                iter = devices.insert(dev, std::move(d));
+            }
+            return iter.value();
+        }
+
+    public:
+        DirPool(const PathStore& paths) : paths(paths) {}
+
+        void resize(int count)
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            workers = count;
+            for (auto& d : devices) d.deques.resize(workers);
+        }
+
+        // Max workers per device (0 - no limit)
+        void set_budgets(int rotational, int solid)
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            rotational_budget = rotational;
+            solid_budget = solid;
+            for (auto& d : devices) d.budget = d.rotational ? rotational_budget : solid_budget;
+            available.wakeAll();
+        }
+
+        // Push dir to worker deque (worker < 0 - push from outside, distribute round robin). Return false if dir already known.
+        bool push(int worker, PathId dir, quint64 dev)
+        {
+            {
+                QMutexLocker<QMutex> l(&visited_mutex);
+                if (dir >= visited.size()) visited.resize(std::max<size_t>(dir + 1, visited.size() * 2));
+                if (visited[dir]) return false;
+                visited[dir] = true;
+                ++pending; // Before dir is counted, so stat() never sees all dirs finished while this one is not queued yet
+                ++visited_count;
+            }
+            // Device type is read from sysfs out of lock - it would stall all workers. Two workers may both read it, it's harmless.
+            bool known;
+            {
+                QMutexLocker<QMutex> l(&mutex);
+                known = devices.contains(dev);
+            }
+            bool rotational = !known && is_rotational_device(paths.path(dir), dev);
+
+            QMutexLocker<QMutex> l(&mutex);
+            if (worker < 0) worker = int(next_external++ % workers);
+            Device& d = device(dev, rotational);
+            d.deques[worker].push_back(dir);
+            ++d.queued;
+            available.wakeOne();
+            return true;
+        }
+
+        // Wait for next dir of device under budget. Return false if pool was stopped
+        bool pop(int worker, Entry& ent)
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            for (;;)
+            {
+                if (exiting) return false;
+                if (!holds && take(worker, ent)) {++in_work; return true;}
+                available.wait(&mutex);
+            }
+        }
+
+        // Dir returned by 'pop' was processed - its device may accept other worker. Returns true if it was the last pending one.
+        bool finish(const Entry& ent)
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            --devices[ent.dev].active;
+            if (!--in_work) idle.wakeAll();
+            available.wakeOne();
+            return --pending == 0;
+        }
+
+        // Stop giving dirs to workers and wait until dirs in work are finished. Nested holds are allowed.
+        // Returns false (pool is not held) if waiting was cancelled by 'cancel_holds'.
+        bool hold()
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            ++holds;
+            while (in_work && !holds_cancelled) idle.wait(&mutex);
+            if (!holds_cancelled) return true;
+            if (!--holds) available.wakeAll();
+            return false;
+        }
+        // For exit - current and later holds don't wait anymore
+        void cancel_holds()
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            holds_cancelled = true;
+            idle.wakeAll();
+        }
+        void release()
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            if (holds && !--holds) available.wakeAll();
+        }
+
+        // Checkpoint support. Save only while held - then every visited dir is either finished or queued.
+        void save(QDataStream& out)
+        {
+            QByteArray bits;
+            {
+                QMutexLocker<QMutex> l(&visited_mutex);
+                bits.fill(0, qsizetype(visited.size() + 7) / 8);
+                for (size_t i = 0; i < visited.size(); ++i)
+                {
+                    if (visited[i]) bits[i / 8] = char(bits[i / 8] | (1 << (i % 8)));
+                }
+            }
+            out << bits;
+            QMutexLocker<QMutex> l(&mutex);
+            quint64 total = 0;
+            for (const auto& d : devices) total += d.queued;
+            out << total;
+            for (auto iter = devices.cbegin(); iter != devices.cend(); ++iter)
+            {
+                for (const auto& dq : iter->deques)
+                {
+                    for (PathId dir : dq) out << dir << iter.key();
+                }
             }
-            queue_counter.release();
         }
-        Cmd pop()
+        // Read saved state. Nothing is changed until 'restore', so broken checkpoint doesn't leave half loaded pool.
+        bool load(QDataStream& in, std::vector<Entry>& queued, QByteArray& visited_bits)
         {
-            for(;;)
+            quint64 total = 0;
+            in >> visited_bits >> total;
+            for (quint64 i = 0; i < total && in.status() == QDataStream::Ok; ++i)
             {
-                queue_counter.acquire();
-                QMutexLocker<QMutex> l(&queue_mutex);
-                if (!oob_commands.empty())
+                Entry ent;
+                in >> ent.dir >> ent.dev;
+                if (ent.dir == PathStore::NoPath || ent.dir >= paths.size()) return false;
+                queued.push_back(ent);
+            }
+            return in.status() == QDataStream::Ok;
+        }
+        // Restore into empty pool. Workers run already, so visited bits go first - subdir of queued dir, finished in saved
+        // session, must not be scanned again. Queued dirs (visited too) go straight to deques, workers are woken after all.
+        void restore(const std::vector<Entry>& queued, const QByteArray& visited_bits)
+        {
+            QHash<quint64, bool> rotational; // Read out of lock, as in 'push'
+            for (const auto& ent : queued)
+            {
+                if (!rotational.contains(ent.dev)) rotational.insert(ent.dev, is_rotational_device(paths.path(ent.dir), ent.dev));
+            }
+            {
+                size_t count = std::min<size_t>(visited_bits.size() * 8, paths.size());
+                QMutexLocker<QMutex> l(&visited_mutex);
+                visited.resize(std::max<size_t>(visited.size(), paths.size()));
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if ((visited_bits[i / 8] & (1 << (i % 8))) && !visited[i]) {visited[i] = true; ++visited_count;}
+                }
+                for (const auto& ent : queued)
                 {
-                    auto result = oob_commands.front();
-                    oob_commands.pop_front();
-                    return result;
+                    if (!visited[ent.dir]) {visited[ent.dir] = true; ++visited_count;}
                 }
-                if (dirs_to_proceed.empty()) continue;
-                QString result = dirs_to_proceed.back();
-                dirs_to_proceed.pop_back();
-                return Cmd{CC_Dir, result};
+                pending += queued.size();
             }
+            QMutexLocker<QMutex> l(&mutex);
+            for (const auto& ent : queued)
+            {
+                Device& d = device(ent.dev, rotational[ent.dev]);
+                d.deques[next_external++ % workers].push_back(ent.dir);
+                ++d.queued;
+            }
+            available.wakeAll();
+        }
+
+        void stop()
+        {
+            QMutexLocker<QMutex> l(&mutex);
+            exiting = true;
+            available.wakeAll();
         }
+
         std::pair<size_t, size_t> stat() // Returns <total_dirs, dirs_to_proceed>
         {
-            QMutexLocker<QMutex> l(&queue_mutex);
-            return { dirs.size(), dirs_to_proceed.size() };
+            QMutexLocker<QMutex> l(&visited_mutex);
+            return { visited_count, pending.loadRelaxed() };
         }
-    } queue;
-    QMutex suspend_mutex;
+    } dirs{paths};
+
+    QVector<QThread*> workers;
+    int worker_count = QThread::idealThreadCount();
+    HashBackend hash_backend = HB_Fast;
+    std::atomic<bool> verify_dups = false;
+    unsigned io_queue_depth = UringReader::DEFAULT_QUEUE_DEPTH;
+    QVector<HashStage> hash_stages;
+    quint32 stages_id = 0; // Fingerprint of hash_stages for hash cache
+    std::unique_ptr<HashCache> hash_cache;
+
+    // Checkpoint: scan state is saved periodically, when scan queue drains and on exit, so later session can resume
+    // without re-reading finished dirs. Dir pool is held while saving - workers finish their dirs and wait. Roots added
+    // by scan_dir are interned and pushed under roots_mutex, which is held while saving too - saved paths cover saved queue.
+    QString checkpoint_path;
+    QMutex roots_mutex;
+    std::atomic<bool> checkpoint_cancelled = false;
+    static constexpr int CHECKPOINT_PERIOD_MS = 5*60*1000;
+    bool save_checkpoint();
+    bool write_checkpoint();
+    bool read_checkpoint(QDataStream&, HashBackend backend, const QVector<HashStage>& stages, bool verify);
+
+    // Empty dirs (without files in whole subtree) are found during scan. Dir result goes up to parent when dir is listed
+    // and all its subdirs are finished. Only dirs with unfinished subtree are kept in empty_pending.
+    struct EmptyNode {
+        qint32 pending = 0; // Subdirs not finished yet. Subdirs can finish before parent is listed - then it is negative.
+        bool listed = false;
+        bool has_files = false; // Somewhere in finished part of subtree
+    };
     QMutex empty_dirs_mutex;
-    bool expect_suspend = false;
-    QVector<QStringList> empty_dirs;
+    QHash<PathId, EmptyNode> empty_pending;
+    QSet<PathId> empty_dirs; // All finished dirs without files, including subdirs of empty ones
+    void dir_finished(PathId dir, int subdirs, bool has_files);
+
+    // Candidate file with metadata from directory enumeration
+    struct PendingFile {
+        PathId file = PathStore::NoPath;
+        FileStat st;
+        bool has_stat = false; // Only size is known, identity is read on demand
+    };
 
-    QMap<QByteArray, QSet<QString>> short_files_store;
+    // Guards size_files_store, inode_files_store, hardlinks_store, stage_files_store, dups_files_store and dup_groups
+    QMutex store_mutex;
+    QHash<qint64, PendingFile> size_files_store; // <file size> -> <first file of this size>, NoPath if size is already not unique
+    QHash<QPair<quint64, quint64>, PathId> inode_files_store; // <dev, inode> -> <first seen link>. Only for files with several links.
+    QMap<PathId, QVector<PathId>> hardlinks_store; // <first seen link> -> <other links to the same inode>
+    // Files with the same key at hash stage. Only singleton is kept (with its stat, to move it to next step when second file comes).
+    // Files reach each stage at most once (dirs are visited once, extra links are skipped), so real groups keep just size.
+    struct StageGroup {
+        PathId first = PathStore::NoPath;
+        quint32 size = 0;
+        FileStat first_st;
+    };
+    QVector<DigestTable<StageGroup>> stage_files_store; // Per hash stage: <key, chained over all previous steps> -> <group>
+    // Files with the same full hash. Most are singletons (same partial hashes, different contents) - they are stored inline,
+    // real groups spill to dup_groups.
+    struct DupSlot {
+        PathId first = PathStore::NoPath;
+        qint32 group = -1; // Index in dup_groups
+    };
     struct DupFilesEntry {
-        QSet<QString> files;
+        QSet<PathId> files;
+        QSet<PathId> verified; // Files confirmed byte-by-byte (in verify mode)
         bool reported = false;
+        bool verifying = false; // Some worker verifies this group now
+    };
+    DigestTable<DupSlot> dups_files_store;
+    std::vector<DupFilesEntry> dup_groups;
+
+    // Progress counters. Each worker updates only its own slot (no lock, no shared cache line), ScanThread::run sums them
+    // and publishes stat_update at fixed rate.
+    struct alignas(64) Counters {
+        std::atomic<size_t> total_files = 0;
+        std::atomic<size_t> total_dups = 0;
+        std::atomic<size_t> total_false_dups = 0;
+        std::atomic<size_t> verified_files = 0;
+        std::atomic<qint64> verified_bytes = 0;
+        std::atomic<qint64> verify_ns = 0;
+        std::atomic<size_t> cached_hashes = 0;
+        std::atomic<size_t> total_hardlinks = 0;
+        std::atomic<qint64> bytes_read = 0;
+        std::atomic<qint64> bytes_hashed = 0;
     };
-    QMap<QByteArray, DupFilesEntry> dups_files_store;
-    ScanState counters{};
+    std::vector<std::unique_ptr<Counters>> worker_counters; // One per worker, last one for other threads
+    Counters resumed_counters; // Totals of session restored from checkpoint
+    QElapsedTimer scan_timer;
+    static constexpr int STAT_PERIOD_MS = 100;
+
+    // Results for UI. Workers append under short lock (dups are found under store_mutex anyway, so workers don't contend here),
+    // UI takes whole buffer at once on its own timer - scanning never waits for UI and UI inserts dups in big batches.
+    QMutex results_mutex;
+    std::vector<DupResult> results;
+    std::atomic<PathId> current_dir = PathStore::NoPath; // Last dir taken by any worker, for display
+
+    void report_dup(PathId file, QByteArray hash)
+    {
+        QMutexLocker<QMutex> l(&results_mutex);
+        results.push_back(DupResult{file, hash});
+    }
+
+    Counters& counters(); // Slot of current thread
+    template<class T, class V = T> static void bump(std::atomic<T>& counter, V value = 1) {counter.fetch_add(T(value), std::memory_order_relaxed);}
+    ScanState collect_state();
 
-    // Scan dir & send StatUpdate signal
-    void do_scan_dir(QString);
+    void worker_loop(int worker);
+
+    // Scan dir, hash its files and queue found dups for UI
+    void do_scan_dir(int worker, PathId dir, quint64 dev);
 
     // Check file. Return true if dups found
-    bool try_file_short(QString);
-    bool try_file_full(QString, int fake_dups_weight);
-    bool try_file_full(QString, const void*, size_t, int fake_dups_weight);
+    bool try_file_size(PendingFile, QVector<PendingFile>* batch = nullptr);
+    bool try_file_step(PathId, const FileStat&, int step, QByteArray prev_key, int fake_dups_weight);
+    bool try_file_key(PathId, const FileStat&, int step, QByteArray key, int fake_dups_weight);
+    void hash_batch(UringReader&, QVector<PendingFile>& batch);
+    bool cached_key(const FileStat&, int step, QByteArray& key);
+    void store_key(PathId, const FileStat&, int step, QByteArray key);
+    bool complete_stat(PendingFile&);
+    bool is_extra_link(PathId, const FileStat&);
+    bool try_file_full(PathId, qint64 size, QByteArray hash, int fake_dups_weight);
+
+    bool hash_file_ranges(QString, QByteArray prev_key, const HashStep&, QByteArray& key);
 
     // Handle bg 'suspend' request
     QFutureWatcher<void> suspend_watcher;
-    QAction* suspend_action = NULL;
 
-    virtual void run() override
+    // Filters. Set before 'start'
+    qint64 min_file_size = 1; // Empty files are never dups
+    QVector<QRegularExpression> exclude_names;
+    bool is_excluded(const QString& name) const
     {
-        for (;;)
-        {
-            auto cmd = queue.pop();
-            switch(cmd.command)
-            {
-                case CC_Dir:
-                {
-                    if (expect_suspend) QThread::msleep(100);
-                    QMutexLocker<QMutex> l(&suspend_mutex);
-                    do_scan_dir(cmd.file);
-                    break;
-                }
-                case CC_Exit: return;
-                case CC_RemoveFile:
-                {
-                    if (dups_files_store.contains(cmd.hash))
-                    {
-                        dups_files_store[cmd.hash].files.remove(cmd.file);
-                    }
-                    break;
-                }
-                case CC_ResetReported:
-                {
-                    for(auto& ff: dups_files_store) ff.reported = false;
-                    break;
-                }
-            }
-        }
+        for (const auto& re : exclude_names) if (re.match(name).hasMatch()) return true;
+        return false;
     }
 
+    virtual void run() override;
+
 public:
     ScanThread(QObject* parent) : QThread(parent) 
     {
-        QObject::connect(&suspend_watcher, &QFutureWatcher<void>::finished, this, [this]() {suspend_action->setDisabled(false);});
+        QObject::connect(&suspend_watcher, &QFutureWatcher<void>::finished, this, &ScanThread::suspended);
+        dirs.resize(worker_count);
+        set_hash_stages(default_hash_stages());
+    }
+    ~ScanThread();
+
+    // Number of parallel scan workers. Should be called before 'start'
+    void set_worker_count(int count) {worker_count = std::max(1, count); dirs.resize(worker_count);}
+
+    // Select hash backend. Can be changed only before first directory is added - hashes of different backends are not comparable.
+    bool set_hash_backend(HashBackend backend)
+    {
+        if (dirs.stat().first) return backend == hash_backend;
+        hash_backend = backend;
+        return true;
+    }
+    HashBackend get_hash_backend() const {return hash_backend;}
+
+    // Verify mode: duplicates are reported only after byte-by-byte comparison of group members
+    void set_verify(bool verify) {verify_dups = verify;}
+    bool get_verify() const {return verify_dups;}
+
+    // Number of requests in flight for batched reads of small files (Linux io_uring). 0 - read each file by worker thread itself.
+    // Falls back to worker reads when io_uring is not available. Should be called before 'start'.
+    void set_io_queue_depth(int depth) {io_queue_depth = std::clamp(depth, 0, 4096);}
+
+    // Persistent hash cache file (empty path - do not use cache). Same restriction as for hash backend.
+    bool set_hash_cache(QString path);
+
+    // Chain of progressive hash stages. Same restriction as for hash backend.
+    bool set_hash_stages(const QVector<HashStage>& stages)
+    {
+        if (dirs.stat().first) return false;
+        hash_stages = stages;
+        Hasher fp(HB_Fast);
+        QByteArray text = (QString::number(HASH_PLAN_VERSION) + ":" + hash_stages_to_string(stages)).toUtf8();
+        fp.add(text.constData(), text.size());
+        memcpy(&stages_id, fp.result().constData(), sizeof(stages_id));
+        stage_files_store.clear();
+        stage_files_store.resize(stages.size());
+        return true;
+    }
+
+    // Files smaller than this are skipped (not counted as dup candidates)
+    void set_min_file_size(qint64 size) {min_file_size = std::max<qint64>(1, size);}
+    // Files and dirs with names matching any of wildcards (like "*.tmp", ".git") are skipped
+    void set_exclude(const QStringList& wildcards)
+    {
+        exclude_names.clear();
+        for (const auto& w : wildcards) exclude_names << QRegularExpression(QRegularExpression::wildcardToRegularExpression(w));
     }
 
+    // Max number of workers scanning one device at once (0 - all workers). Spinning disks are detected automatically.
+    // Reads of files which are hashed or verified from dirs of other devices are not limited (see DirPool).
+    void set_device_budgets(int rotational, int solid) {dirs.set_budgets(rotational, solid);}
+
     void scan_dir(QString d) 
     {
         QFileInfo fi(d);
-        if (fi.isDir() && !fi.isSymLink()) queue.push(fi.absoluteFilePath());
+        FileStat st;
+        if (!fi.isDir() || fi.isSymLink()) return;
+        QMutexLocker<QMutex> l(&roots_mutex);
+        PathId dir = paths.intern(fi.absoluteFilePath());
+        if (dir == PathStore::NoPath) {emit error("Too many paths - '" + d + "' is not scanned"); return;}
+        dirs.push(-1, dir, get_file_stat(fi.absoluteFilePath(), st) ? st.dev : 0);
         // Stat update event is not sent here - it will be sent from processing thread later.
     }
 
     void force_exit() {queue.push(Cmd{CC_Exit});}
+    void exit_with_checkpoint() {queue.push(Cmd{CC_Checkpoint}); queue.push(Cmd{CC_Exit});}
+    // Abort checkpoint which is waited for or written now, and don't write later ones. Previous checkpoint file is kept.
+    void cancel_checkpoint() {checkpoint_cancelled = true; dirs.cancel_holds();}
+
+    // Checkpoint file (empty path - do not write checkpoints). Should be called before 'start'.
+    void set_checkpoint(QString path) {checkpoint_path = path;}
+    static QString default_checkpoint_path();
+
+    // Restore scan saved by previous session: hash settings, found files and dups, queue of not yet scanned dirs.
+    // Possible only before first directory is added. Dups of previous session are reported again.
+    bool resume(QString path);
     void reset_reported() {queue.push(Cmd{CC_ResetReported});}
-    void remove_file(QString file, QByteArray hash) {queue.push(Cmd{ CC_RemoveFile, file, hash});}
 
-    void suspend_resume(QAction*, bool checked);
+    // Paths of files reported by signals. Shared with UI - ids stay valid for lifetime of scanner.
+    const PathStore& get_paths() const {return paths;}
+    void remove_file(PathId file, QByteArray hash) {queue.push(Cmd{ CC_RemoveFile, file, hash});}
+
+    // Move dups found since last call to 'out' (previous content of 'out' is dropped). Files of one group are in order of discovery.
+    void take_results(std::vector<DupResult>& out)
+    {
+        out.clear();
+        QMutexLocker<QMutex> l(&results_mutex);
+        out.swap(results);
+    }
+    PathId get_current_dir() const {return current_dir.load(std::memory_order_relaxed);}
+
+    // Pause/continue scan. 'suspended' is emitted when pause is complete (dirs in work are finished)
+    void suspend_resume(bool checked);
+
+    QStringList get_empty_dirs(); // Topmost empty dirs found so far
 
-    QStringList get_empty_dirs();
+    // Hardlinks found so far: <first seen link> -> <other links to the same inode>. Other links are not hashed and not reported as dups.
+    QMap<QString, QStringList> get_hardlinks();
 
 signals:
-    void new_dup(QString fname, QByteArray hash);
-    void new_dir(QString);
     void stat_update(ScanState event);
     void error(QString);
+    void suspended();
 };
@@ -2,18 +2,23 @@
 
 #include <stdint.h>
 
-#include <QtWidgets>
+#include <QtCore>
 #include <QMap>
 #include <QSet>
 #include <QFileInfo>
 #include <QFile>
-#include <QGuiApplication>
 #include <QMultiHash>
 
+// Scanner sources are shared with console tool (ddup-cli), which is built without Gui/Widgets
+#ifdef QT_WIDGETS_LIB
+#include <QtWidgets>
+#include <QGuiApplication>
+
 struct WaitCursor {
     WaitCursor() { QGuiApplication::setOverrideCursor(QCursor(Qt::WaitCursor)); }
     ~WaitCursor() { QGuiApplication::restoreOverrideCursor(); }
 };
+#endif
 
 enum FileNodeMode {
     FNM_None = 0,
@@ -38,6 +43,7 @@ enum FileNodeMode {
 Q_DECLARE_FLAGS(FileNodeModes, FileNodeMode)
 Q_DECLARE_OPERATORS_FOR_FLAGS(FileNodeModes)
 
+#ifdef QT_WIDGETS_LIB
 inline QStringList get_list(QListWidget* lst)
 {
     QStringList result;
@@ -48,3 +54,4 @@ inline QStringList get_list(QListWidget* lst)
     }
     return result;
 }
+#endif
@@ -0,0 +1,342 @@
+#include "stdafx.h"
+
+#include <atomic>
+
+#include "uring_reader.h"
+
+#if defined(Q_OS_LINUX) && __has_include(<linux/io_uring.h>)
+#define URING_READER 1
+#include <deque>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#else
+#define URING_READER 0
+#endif
+
+#if URING_READER
+
+// Minimal raw io_uring (no liburing dependency): one submission and one completion ring, used by one thread only
+struct UringReader::Ring {
+    int fd = -1;
+    unsigned entries = 0;
+    void* sq_ptr = MAP_FAILED;
+    size_t sq_len = 0;
+    void* cq_ptr = MAP_FAILED;
+    size_t cq_len = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqes_len = 0;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+    unsigned sqe_tail = 0; // Local tail - published to kernel on submit
+
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool setup(unsigned queue_depth)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, queue_depth, &p);
+        if (fd < 0) return false;
+        // OPENAT, READ and CLOSE operations appeared together with RW_CUR_POS feature (5.6)
+        if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_RW_CUR_POS)) return false;
+        entries = p.sq_entries;
+
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) sq_len = cq_len = std::max(sq_len, cq_len);
+        sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) return false;
+        cq_ptr = single_mmap ? sq_ptr : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) return false;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+
+        char* sq = (char*)sq_ptr;
+        sq_head = (unsigned*)(sq + p.sq_off.head);
+        sq_tail = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        char* cq = (char*)cq_ptr;
+        cq_head = (unsigned*)(cq + p.cq_off.head);
+        cq_tail = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        sqe_tail = *sq_tail;
+        return true;
+    }
+
+    // Caller keeps number of requests in flight below 'entries', so submission queue is never full
+    io_uring_sqe* get_sqe(quint64 user_data)
+    {
+        unsigned idx = sqe_tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = user_data;
+        sq_array[idx] = idx;
+        ++sqe_tail;
+        return sqe;
+    }
+
+    // Submit prepared requests and wait for at least one completion
+    bool submit_and_wait()
+    {
+        __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+        for (;;)
+        {
+            unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            int ret = (int)syscall(__NR_io_uring_enter, fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret >= 0) return true;
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+            if (errno != EINTR && __atomic_load_n(cq_head, __ATOMIC_RELAXED) != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return true;
+        }
+    }
+
+    // Wait for completion of requests already taken by kernel, without submitting new ones
+    bool wait()
+    {
+        for (;;)
+        {
+            int ret = (int)syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret >= 0) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+    // Prepared requests not taken by kernel yet
+    unsigned unsubmitted() const {return sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);}
+
+    bool peek(io_uring_cqe& cqe)
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) return false;
+        cqe = cqes[head & *cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+namespace {
+
+enum OpKind {OK_Open, OK_Read, OK_Close};
+
+// Request tag: job index, range index and operation kind
+quint64 make_tag(int job, int range, OpKind kind) {return (quint64(job) << 32) | (quint64(range) << 8) | kind;}
+
+}
+
+UringReader::UringReader(unsigned queue_depth) : ring(new Ring), depth(queue_depth)
+{
+    if (!ring->setup(queue_depth)) ring.reset();
+}
+
+UringReader::~UringReader() = default;
+
+UringReader* UringReader::for_thread(unsigned queue_depth)
+{
+    static std::atomic<bool> unavailable = [] {const char* env = getenv("DDUP_IO_URING"); return env && strcmp(env, "0") == 0;}();
+    static thread_local std::unique_ptr<UringReader> reader;
+    if (unavailable) return nullptr;
+    if (!reader || reader->depth != queue_depth) reader.reset(new UringReader(queue_depth));
+    if (!reader->ring)
+    {
+        // Old kernel, seccomp filter or io_uring disabled by sysctl - it will not work in other threads too
+        unavailable = true;
+        reader.reset();
+    }
+    return reader.get();
+}
+
+bool UringReader::read(QVector<Job>& jobs, std::function<void(int)> done)
+{
+    if (!ring) return false;
+    struct JobState {
+        QByteArray name;
+        int fd = -1;
+        int reads_left = 0;
+        bool noatime = true;
+        bool failed = false;
+        QVector<qint64> done; // Bytes read per range
+        QVector<qint64> pos;  // Position of range in data
+    };
+    QVector<JobState> state(jobs.size());
+    std::deque<quint64> ready; // Requests of started jobs - submitted before opening new files
+    unsigned limit = std::min(depth, ring->entries);
+    unsigned in_flight = 0;
+    int next_job = 0, jobs_left = jobs.size();
+
+    auto prepare = [&](quint64 tag) {
+        int j = int(tag >> 32), r = int((tag >> 8) & 0xFFFFFF);
+        JobState& js = state[j];
+        io_uring_sqe* sqe = ring->get_sqe(tag);
+        switch (OpKind(tag & 0xFF))
+        {
+            case OK_Open:
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (quint64)js.name.constData();
+#ifdef O_NOATIME
+                sqe->open_flags = O_RDONLY | O_CLOEXEC | (js.noatime ? O_NOATIME : 0);
+#else
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+#endif
+                break;
+            case OK_Read:
+            {
+                auto [offset, length] = jobs[j].ranges[r];
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = js.fd;
+                sqe->addr = (quint64)(jobs[j].data.data() + js.pos[r] + js.done[r]);
+                sqe->len = unsigned(length - js.done[r]);
+                sqe->off = offset + js.done[r];
+                break;
+            }
+            case OK_Close:
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = js.fd;
+                break;
+        }
+        ++in_flight;
+    };
+
+    auto finish_reads = [&](int j) {
+        JobState& js = state[j];
+        if (--js.reads_left) return;
+        jobs[j].result = js.failed ? JR_ReadError : JR_Ok;
+        ready.push_back(make_tag(j, 0, OK_Close));
+        if (done) done(j);
+    };
+
+    auto complete = [&](const io_uring_cqe& cqe) {
+        --in_flight;
+        int j = int(cqe.user_data >> 32), r = int((cqe.user_data >> 8) & 0xFFFFFF);
+        JobState& js = state[j];
+        switch (OpKind(cqe.user_data & 0xFF))
+        {
+            case OK_Open:
+                if (cqe.res == -EPERM && js.noatime) // O_NOATIME allowed only for file owner
+                {
+                    js.noatime = false;
+                    ready.push_back(make_tag(j, 0, OK_Open));
+                    break;
+                }
+                if (cqe.res < 0)
+                {
+                    jobs[j].result = JR_OpenError;
+                    --jobs_left;
+                    if (done) done(j);
+                    break;
+                }
+                js.fd = cqe.res;
+                js.reads_left = jobs[j].ranges.size();
+                for (int i = 0; i < jobs[j].ranges.size(); ++i) ready.push_back(make_tag(j, i, OK_Read));
+                if (!js.reads_left) {js.reads_left = 1; finish_reads(j);}
+                break;
+            case OK_Read:
+                if (cqe.res <= 0) js.failed = true; // Error or file was truncated
+                else if (!js.failed && (js.done[r] += cqe.res) < jobs[j].ranges[r].second)
+                {
+                    ready.push_back(cqe.user_data); // Short read - continue
+                    break;
+                }
+                finish_reads(j);
+                break;
+            case OK_Close:
+                js.fd = -1;
+                --jobs_left;
+                break;
+        }
+    };
+
+    for (int j = 0; j < jobs.size(); ++j)
+    {
+        JobState& js = state[j];
+        js.name = QFile::encodeName(jobs[j].file);
+        qint64 total = 0;
+        for (const auto& range : jobs[j].ranges) {js.pos << total; js.done << 0; total += range.second;}
+        jobs[j].data.resize(total);
+        jobs[j].result = JR_Pending;
+    }
+
+    while (jobs_left)
+    {
+        while (in_flight < limit)
+        {
+            if (!ready.empty()) {prepare(ready.front()); ready.pop_front();}
+            else if (next_job < jobs.size()) prepare(make_tag(next_job++, 0, OK_Open));
+            else break;
+        }
+        if (!ring->submit_and_wait())
+        {
+            // Ring is broken. Ring teardown does not wait for requests taken by kernel, so they are drained here - otherwise
+            // kernel could write to buffers which caller already reuses, and files opened later would be leaked.
+            unsigned submitted = in_flight - ring->unsubmitted();
+            io_uring_cqe cqe;
+            for (;;)
+            {
+                while (ring->peek(cqe))
+                {
+                    --submitted;
+                    int j = int(cqe.user_data >> 32);
+                    switch (OpKind(cqe.user_data & 0xFF))
+                    {
+                        case OK_Open: if (cqe.res >= 0) ::close(cqe.res); break;
+                        case OK_Close: state[j].fd = -1; break;
+                        case OK_Read: break;
+                    }
+                }
+                if (!submitted || !ring->wait()) break;
+            }
+            if (submitted)
+            {
+                // Can't even wait. Ring and buffers are abandoned (leaked), so requests left can complete into them safely.
+                (void)ring.release();
+                for (auto& job : jobs)
+                {
+                    if (job.result == JR_Pending) (void)new QByteArray(std::move(job.data));
+                }
+            }
+            ring.reset();
+            // Jobs which are not done yet stay in JR_Pending state
+            for (const auto& js : state)
+            {
+                if (js.fd >= 0) ::close(js.fd);
+            }
+            return false;
+        }
+        io_uring_cqe cqe;
+        while (ring->peek(cqe)) complete(cqe);
+    }
+    return true;
+}
+
+#else
+
+struct UringReader::Ring {};
+
+UringReader::UringReader(unsigned queue_depth) : depth(queue_depth) {}
+UringReader::~UringReader() = default;
+
+UringReader* UringReader::for_thread(unsigned) {return nullptr;}
+bool UringReader::read(QVector<Job>&, std::function<void(int)>) {return false;}
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QByteArray>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+#include <memory>
+
+// Batched reader of small files based on Linux io_uring. Open, reads and close of all files in batch are submitted
+// asynchronously with up to 'queue_depth' requests in flight, so one thread keeps many requests queued to SSD.
+// Not available on other platforms, on kernels older than 5.6 or if io_uring is disabled - caller uses FileReader then.
+class UringReader {
+public:
+    static constexpr unsigned DEFAULT_QUEUE_DEPTH = 32;
+    static constexpr qint64 MAX_JOB_SIZE = 256*1024; // Longer ranges are streamed by FileReader
+
+    enum JobResult {
+        JR_Pending,   // Not done - ring failed, read it other way
+        JR_OpenError,
+        JR_ReadError, // Read error or file is shorter than expected
+        JR_Ok
+    };
+
+    struct Job {
+        QString file;
+        QVector<QPair<qint64, qint64>> ranges; // <offset, length>
+        QByteArray data; // Contents of all ranges one after another
+        JobResult result = JR_Pending;
+    };
+
+    ~UringReader();
+    UringReader(const UringReader&) = delete;
+    UringReader& operator=(const UringReader&) = delete;
+
+    // Read all jobs. 'done' is called with index of each job as soon as its result is known (before its file is closed), so
+    // caller can proceed with data while other reads are in flight. Return false if ring failed - jobs which are not done
+    // are left in JR_Pending state.
+    bool read(QVector<Job>& jobs, std::function<void(int)> done = {});
+
+    // Reader of current thread or nullptr if io_uring can't be used.
+    // DDUP_IO_URING=0 environment variable disables it (for benchmarks and cross checks).
+    static UringReader* for_thread(unsigned queue_depth);
+
+private:
+    struct Ring;
+    std::unique_ptr<Ring> ring;
+    unsigned depth;
+
+    explicit UringReader(unsigned queue_depth);
+};